@@ -1,7 +1,8 @@
 /*
  * piHiPri:
  *	Simple way to get your program running at high priority
- *	with realtime schedulling.
+ *	with realtime schedulling, and the finer grained real-time
+ *	configuration of the library's and program's threads.
  *
  *	Copyright (c) 2012 Gordon Henderson
  ***********************************************************************
@@ -24,8 +25,18 @@
  ***********************************************************************
  */
 
+#ifndef	_GNU_SOURCE
+#define	_GNU_SOURCE	// CPU_SET and pthread_setaffinity_np
+#endif
+
+#include <stdio.h>
 #include <sched.h>
 #include <string.h>
+#include <alloca.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 #include "wiringPi.h"
 
@@ -49,3 +60,167 @@ int piHiPri (const int pri)
 
   return sched_setscheduler (0, SCHED_RR, &sched) ;
 }
+
+
+// Per-subsystem real-time settings, read by each thread as it starts up.
+//	The library's defaults are the priorities its threads always had.
+
+struct rtConfigStruct
+{
+  int policy ;
+  int priority ;
+  unsigned long long cpuMask ;
+} ;
+
+static struct rtConfigStruct rtConfig [WPI_RT_SUBSYSTEMS] =
+{
+  { SCHED_RR,    90, 0 },	// WPI_RT_SOFTPWM
+  { SCHED_RR,    50, 0 },	// WPI_RT_SOFTTONE
+  { SCHED_RR,    50, 0 },	// WPI_RT_SOFTSERVO
+  { SCHED_RR,    55, 0 },	// WPI_RT_ISR
+  { SCHED_OTHER,  0, 0 },	// WPI_RT_USER ...
+  { SCHED_OTHER,  0, 0 },
+  { SCHED_OTHER,  0, 0 },
+  { SCHED_OTHER,  0, 0 },
+} ;
+
+static pthread_mutex_t rtConfigLock = PTHREAD_MUTEX_INITIALIZER ;
+static unsigned int rtStackPrefault = 0 ;	// Non-zero once memory is locked
+
+
+/*
+ * piRtConfigure:
+ *	Set the scheduling policy (SCHED_FIFO, SCHED_RR or SCHED_OTHER), the
+ *	priority and the CPUs (bit n for CPU n, 0 for any) of a subsystem's
+ *	threads. A priority of 0 leaves their scheduling alone. Only threads
+ *	started afterwards pick it up, so call it before softPwmCreate,
+ *	wiringPiISR etc.
+ *********************************************************************************
+ */
+
+int piRtConfigure (int subsystem, int policy, int priority, unsigned long long cpuMask)
+{
+  if (subsystem < 0 || subsystem >= WPI_RT_SUBSYSTEMS)
+    return -1 ;
+  if (policy != SCHED_FIFO && policy != SCHED_RR && policy != SCHED_OTHER)
+    return -1 ;
+
+  pthread_mutex_lock (&rtConfigLock) ;
+  rtConfig [subsystem].policy   = policy ;
+  rtConfig [subsystem].priority = priority ;
+  rtConfig [subsystem].cpuMask  = cpuMask ;
+  pthread_mutex_unlock (&rtConfigLock) ;
+
+  return 0 ;
+}
+
+
+/*
+ * rtPrefaultStack:
+ *	Touch the next bytes of the calling thread's stack so they are
+ *	resident (and, after mlockall, locked) before the thread has to meet
+ *	any deadline.
+ *********************************************************************************
+ */
+
+static void rtPrefaultStack (unsigned int bytes)
+{
+  volatile unsigned char *stack ;
+  long pagesize = sysconf (_SC_PAGESIZE) ;
+  unsigned int i ;
+
+  if (bytes == 0)
+    return ;
+  if (pagesize <= 0)
+    pagesize = 4096 ;
+
+// One volatile store per page, a memset of a block nobody reads is
+//	removed by the compiler as a dead store
+
+  stack = alloca (bytes) ;
+  for (i = 0 ; i < bytes ; i += (unsigned int)pagesize)
+    stack [i] = 0 ;
+  stack [bytes - 1] = 0 ;
+  __asm__ volatile ("" :: "r" (stack) : "memory") ;
+}
+
+
+/*
+ * piRtLockMemory:
+ *	Lock the program's current and future pages in RAM, so a real-time
+ *	thread never waits on a page fault, and prefault stackPrefault bytes
+ *	of the calling thread's stack and of every thread piRtApply is called
+ *	from afterwards. Needs root or a large enough RLIMIT_MEMLOCK.
+ *********************************************************************************
+ */
+
+int piRtLockMemory (unsigned int stackPrefault)
+{
+  if (mlockall (MCL_CURRENT | MCL_FUTURE) < 0)
+  {
+    fprintf (stderr, "wiringPi: mlockall failed: %s\n", strerror (errno)) ;
+    return -1 ;
+  }
+
+  pthread_mutex_lock (&rtConfigLock) ;
+  rtStackPrefault = stackPrefault ;
+  pthread_mutex_unlock (&rtConfigLock) ;
+
+  rtPrefaultStack (stackPrefault) ;
+  return 0 ;
+}
+
+
+/*
+ * piRtApply:
+ *	Give the calling thread the affinity and scheduling of its subsystem
+ *	and prefault its stack if memory is locked. Each setting is tried even
+ *	if another fails, -1 is returned if any did (scheduling normally does
+ *	when not running as root).
+ *********************************************************************************
+ */
+
+int piRtApply (int subsystem)
+{
+  struct rtConfigStruct config ;
+  struct sched_param sched ;
+  unsigned int prefault ;
+  cpu_set_t cpus ;
+  int cpu, result = 0 ;
+
+  if (subsystem < 0 || subsystem >= WPI_RT_SUBSYSTEMS)
+    return -1 ;
+
+  pthread_mutex_lock (&rtConfigLock) ;
+  config   = rtConfig [subsystem] ;
+  prefault = rtStackPrefault ;
+  pthread_mutex_unlock (&rtConfigLock) ;
+
+  if (config.cpuMask != 0)
+  {
+    CPU_ZERO (&cpus) ;
+    for (cpu = 0 ; cpu < 64 ; ++cpu)
+      if (config.cpuMask & (1ULL << cpu))
+        CPU_SET (cpu, &cpus) ;
+    if (pthread_setaffinity_np (pthread_self (), sizeof (cpus), &cpus) != 0)
+      result = -1 ;
+  }
+
+  if (config.priority > 0)
+  {
+    memset (&sched, 0, sizeof (sched)) ;
+    if (config.policy == SCHED_OTHER)
+      sched.sched_priority = 0 ;
+    else if (config.priority > sched_get_priority_max (config.policy))
+      sched.sched_priority = sched_get_priority_max (config.policy) ;
+    else
+      sched.sched_priority = config.priority ;
+    if (pthread_setschedparam (pthread_self (), config.policy, &sched) != 0)
+      result = -1 ;
+  }
+
+  if (prefault != 0)
+    rtPrefaultStack (prefault) ;
+
+  return result ;
+}
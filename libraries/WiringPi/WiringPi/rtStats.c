@@ -0,0 +1,427 @@
+/*
+ * rtStats.c:
+ *	Wake-up lateness statistics for the real-time threads of wiringPi
+ *	(softPwm, softServo, softTone, the ISR dispatcher) and of programs
+ *	using it.
+ *
+ *	Copyright (c) 2012-2017 Gordon Henderson
+ ***********************************************************************
+ * This file is part of wiringPi:
+ *	https://github.com/WiringPi/WiringPi/
+ *
+ *    wiringPi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as
+ *    published by the Free Software Foundation, either version 3 of the
+ *    License, or (at your option) any later version.
+ *
+ *    wiringPi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with wiringPi.
+ *    If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "wiringPi.h"
+
+// Statistics are off until wiringPiRtStatsEnable (1) is called or the
+//	WIRINGPI_RTSTATS environment variable is set. Once on, they live in
+//	/dev/shm/wiringpi_rtstats.<pid> so "gpio rtstats" can dump them from
+//	outside while the program runs. Each slot has a single writer (its
+//	thread), readers may see a sample half way through being added.
+
+#define	RTSTATS_MAGIC		0x57505254	// "WPRT"
+#define	RTSTATS_VERSION		1
+#define	RTSTATS_PATH		"/dev/shm/wiringpi_rtstats."
+
+struct rtStatsShared
+{
+  unsigned int     magic ;
+  unsigned int     version ;
+  int              pid ;
+  int              count ;
+  struct wpiRtStats slots [WPI_RTSTATS_SLOTS] ;
+} ;
+
+static struct rtStatsShared *rtStatsMap = NULL ;	// Never unmapped, threads hold slots in it
+static struct rtStatsShared *rtStats    = NULL ;	// rtStatsMap while enabled
+static pthread_mutex_t rtStatsLock = PTHREAD_MUTEX_INITIALIZER ;
+static int rtStatsEnvChecked = FALSE ;
+
+static __thread char               threadName [WPI_RTSTATS_NAME] ;
+static __thread struct wpiRtStats *threadStats = NULL ;
+
+
+/*
+ * rtStatsBucket: rtStatsBucketLow:
+ *	HDR-style buckets: exact below 4ns, then four linear sub-buckets for
+ *	every power of two, so the resolution is 25% of the value anywhere
+ *	from nanoseconds to seconds.
+ *********************************************************************************
+ */
+
+static int rtStatsBucket (unsigned long long ns)
+{
+  int e, bucket ;
+
+  if (ns < 4)
+    return (int)ns ;
+
+  e      = 63 - __builtin_clzll (ns) ;
+  bucket = 4 * (e - 1) + (int)((ns >> (e - 2)) & 3) ;
+
+  return (bucket < WPI_RTSTATS_BUCKETS) ? bucket : WPI_RTSTATS_BUCKETS - 1 ;
+}
+
+static unsigned long long rtStatsBucketLow (int bucket)
+{
+  if (bucket < 4)
+    return (unsigned long long)bucket ;
+
+  return (unsigned long long)(4 + (bucket & 3)) << (bucket / 4 - 1) ;
+}
+
+
+/*
+ * rtStatsRemove:
+ *	atexit handler, the stats of a finished program are of no more use.
+ *********************************************************************************
+ */
+
+static void rtStatsRemove (void)
+{
+  char path [64] ;
+
+  snprintf (path, sizeof (path), RTSTATS_PATH "%d", (int)getpid ()) ;
+  unlink (path) ;
+}
+
+
+/*
+ * wiringPiRtStatsEnable:
+ *	Start (or stop) collecting. Threads that have called
+ *	wiringPiRtStatsThread pick up their slot with their next sample, so
+ *	this can be called before or after the soft PWM/tone threads start.
+ *********************************************************************************
+ */
+
+int wiringPiRtStatsEnable (int enable)
+{
+  struct rtStatsShared *shared ;
+  char path [64] ;
+  int fd ;
+
+  pthread_mutex_lock (&rtStatsLock) ;
+  rtStatsEnvChecked = TRUE ;
+
+  if (!enable)
+  {
+    __atomic_store_n (&rtStats, NULL, __ATOMIC_RELEASE) ;
+    pthread_mutex_unlock (&rtStatsLock) ;
+    return 0 ;
+  }
+
+  if (rtStatsMap != NULL)
+  {
+    __atomic_store_n (&rtStats, rtStatsMap, __ATOMIC_RELEASE) ;
+    pthread_mutex_unlock (&rtStatsLock) ;
+    return 0 ;
+  }
+
+  snprintf (path, sizeof (path), RTSTATS_PATH "%d", (int)getpid ()) ;
+  fd = open (path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) ;
+  if (fd < 0 || ftruncate (fd, sizeof (struct rtStatsShared)) < 0)
+  {
+    fprintf (stderr, "wiringPi: unable to create %s: %s\n", path, strerror (errno)) ;
+    if (fd >= 0)
+      close (fd) ;
+    pthread_mutex_unlock (&rtStatsLock) ;
+    return -1 ;
+  }
+
+  shared = mmap (NULL, sizeof (struct rtStatsShared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) ;
+  close (fd) ;
+  if (shared == MAP_FAILED)
+  {
+    fprintf (stderr, "wiringPi: unable to map %s: %s\n", path, strerror (errno)) ;
+    unlink (path) ;
+    pthread_mutex_unlock (&rtStatsLock) ;
+    return -1 ;
+  }
+
+  shared->version = RTSTATS_VERSION ;
+  shared->pid     = (int)getpid () ;
+  shared->count   = 0 ;
+  __atomic_store_n (&shared->magic, RTSTATS_MAGIC, __ATOMIC_RELEASE) ;
+  atexit (rtStatsRemove) ;
+
+  __atomic_store_n (&rtStatsMap, shared, __ATOMIC_RELEASE) ;
+  __atomic_store_n (&rtStats, shared, __ATOMIC_RELEASE) ;
+  pthread_mutex_unlock (&rtStatsLock) ;
+  return 0 ;
+}
+
+
+/*
+ * wiringPiRtStatsThread:
+ *	Name the calling thread for the statistics. Only threads that have a
+ *	name are recorded, so delays in ordinary program threads cost nothing.
+ *********************************************************************************
+ */
+
+void wiringPiRtStatsThread (const char *name)
+{
+  strncpy (threadName, name, WPI_RTSTATS_NAME - 1) ;
+  threadName [WPI_RTSTATS_NAME - 1] = 0 ;
+  threadStats = NULL ;
+
+  pthread_mutex_lock (&rtStatsLock) ;
+  if (!rtStatsEnvChecked)
+  {
+    rtStatsEnvChecked = TRUE ;
+    if (getenv ("WIRINGPI_RTSTATS") != NULL)
+    {
+      pthread_mutex_unlock (&rtStatsLock) ;
+      wiringPiRtStatsEnable (TRUE) ;
+      return ;
+    }
+  }
+  pthread_mutex_unlock (&rtStatsLock) ;
+}
+
+
+/*
+ * rtStatsClaim:
+ *	Give the calling thread the next free slot.
+ *********************************************************************************
+ */
+
+static struct wpiRtStats *rtStatsClaim (struct rtStatsShared *shared)
+{
+  struct wpiRtStats *stats = NULL ;
+
+  pthread_mutex_lock (&rtStatsLock) ;
+  if (shared->count < WPI_RTSTATS_SLOTS)
+  {
+    stats = &shared->slots [shared->count] ;
+    memset (stats, 0, sizeof (*stats)) ;
+    strcpy (stats->name, threadName) ;
+    stats->tid     = (int)syscall (SYS_gettid) ;
+    stats->minLate = ~0ULL ;
+    __atomic_store_n (&shared->count, shared->count + 1, __ATOMIC_RELEASE) ;
+  }
+  pthread_mutex_unlock (&rtStatsLock) ;
+
+  if (stats == NULL)
+    threadName [0] = 0 ;	// Out of slots, stop trying
+  return stats ;
+}
+
+
+/*
+ * wiringPiRtStatsRecord:
+ *	Add a wake-up of the calling thread at now for something due at
+ *	deadline (both piNanos64 times). missed counts deadlines the thread
+ *	could not make at all. delayUntilNanos records every wait of a named
+ *	thread by itself, this is for loops that wake up some other way.
+ *********************************************************************************
+ */
+
+void wiringPiRtStatsRecord (unsigned long long deadline, unsigned long long now, unsigned int missed)
+{
+  struct rtStatsShared *shared = __atomic_load_n (&rtStats, __ATOMIC_ACQUIRE) ;
+  struct wpiRtStats *stats = threadStats ;
+  unsigned long long late = (now > deadline) ? now - deadline : 0 ;
+  int bucket ;
+
+  if (shared == NULL)
+    return ;
+
+  if (stats == NULL)
+  {
+    if (threadName [0] == 0 || (stats = threadStats = rtStatsClaim (shared)) == NULL)
+      return ;
+  }
+
+  bucket = rtStatsBucket (late) ;
+  __atomic_store_n (&stats->buckets [bucket], stats->buckets [bucket] + 1, __ATOMIC_RELAXED) ;
+  __atomic_store_n (&stats->totalLate, stats->totalLate + late, __ATOMIC_RELAXED) ;
+  if (late < stats->minLate)
+    __atomic_store_n (&stats->minLate, late, __ATOMIC_RELAXED) ;
+  if (late > stats->maxLate)
+    __atomic_store_n (&stats->maxLate, late, __ATOMIC_RELAXED) ;
+  if (missed)
+    __atomic_store_n (&stats->missed, stats->missed + missed, __ATOMIC_RELAXED) ;
+  __atomic_store_n (&stats->samples, stats->samples + 1, __ATOMIC_RELEASE) ;
+}
+
+
+/*
+ * wiringPiRtStatsGet:
+ *	Copy out the statistics of the slot'th recorded thread of this
+ *	program. Returns the number of slots in use, so it can be called
+ *	with slot 0 first to find out how many there are.
+ *********************************************************************************
+ */
+
+int wiringPiRtStatsGet (int slot, struct wpiRtStats *stats)
+{
+  struct rtStatsShared *shared = __atomic_load_n (&rtStatsMap, __ATOMIC_ACQUIRE) ;
+  int count ;
+
+  if (shared == NULL)
+    return 0 ;
+
+  count = __atomic_load_n (&shared->count, __ATOMIC_ACQUIRE) ;
+  if (slot < 0 || slot >= count)
+    return count ;
+
+  memcpy (stats, &shared->slots [slot], sizeof (*stats)) ;
+  return count ;
+}
+
+
+/*
+ * wiringPiRtStatsPercentile:
+ *	Lateness below which the fraction p of the samples fall, to the
+ *	resolution of the buckets.
+ *********************************************************************************
+ */
+
+unsigned long long wiringPiRtStatsPercentile (const struct wpiRtStats *stats, double p)
+{
+  unsigned long long seen = 0, want ;
+  int bucket ;
+
+  if (stats->samples == 0)
+    return 0 ;
+
+  want = (unsigned long long)(p * (double)stats->samples) ;
+  for (bucket = 0 ; bucket < WPI_RTSTATS_BUCKETS ; ++bucket)
+  {
+    seen += stats->buckets [bucket] ;
+    if (seen > want)
+      break ;
+  }
+  if (bucket == WPI_RTSTATS_BUCKETS)
+    return stats->maxLate ;
+
+  return rtStatsBucketLow (bucket) ;
+}
+
+
+/*
+ * rtStatsPrint:
+ *	One thread's statistics, in microseconds.
+ *********************************************************************************
+ */
+
+static void rtStatsPrint (const struct wpiRtStats *stats, int histogram)
+{
+  unsigned long long samples = stats->samples ;
+  int bucket ;
+
+  printf ("  %-24s tid %-7d %12llu wake-ups %8llu missed\n", stats->name, stats->tid, samples, stats->missed) ;
+  if (samples == 0)
+    return ;
+
+  printf ("    late us: min %.1f  mean %.1f  p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f  jitter %.1f\n",
+    stats->minLate / 1000.0, (stats->totalLate / samples) / 1000.0,
+    wiringPiRtStatsPercentile (stats, 0.5)   / 1000.0,
+    wiringPiRtStatsPercentile (stats, 0.99)  / 1000.0,
+    wiringPiRtStatsPercentile (stats, 0.999) / 1000.0,
+    stats->maxLate / 1000.0, (stats->maxLate - stats->minLate) / 1000.0) ;
+
+  if (!histogram)
+    return ;
+
+  for (bucket = 0 ; bucket < WPI_RTSTATS_BUCKETS ; ++bucket)
+    if (stats->buckets [bucket] != 0)
+      printf ("    >= %10.3f us %12llu\n", rtStatsBucketLow (bucket) / 1000.0, stats->buckets [bucket]) ;
+}
+
+
+/*
+ * rtStatsDumpPid:
+ *	Map another (or this) program's statistics read-only and print them.
+ *********************************************************************************
+ */
+
+static int rtStatsDumpPid (int pid, int histogram)
+{
+  struct rtStatsShared *shared ;
+  struct wpiRtStats stats ;
+  char path [64] ;
+  int fd, i, count ;
+
+  snprintf (path, sizeof (path), RTSTATS_PATH "%d", pid) ;
+  if ((fd = open (path, O_RDONLY | O_CLOEXEC)) < 0)
+    return -1 ;
+
+  shared = mmap (NULL, sizeof (struct rtStatsShared), PROT_READ, MAP_SHARED, fd, 0) ;
+  close (fd) ;
+  if (shared == MAP_FAILED)
+    return -1 ;
+
+  if (__atomic_load_n (&shared->magic, __ATOMIC_ACQUIRE) != RTSTATS_MAGIC || shared->version != RTSTATS_VERSION)
+  {
+    munmap (shared, sizeof (struct rtStatsShared)) ;
+    errno = EINVAL ;
+    return -1 ;
+  }
+
+  printf ("pid %d%s:\n", pid, (kill (pid, 0) < 0 && errno == ESRCH) ? " (exited)" : "") ;
+  count = __atomic_load_n (&shared->count, __ATOMIC_ACQUIRE) ;
+  for (i = 0 ; i < count ; ++i)
+  {
+    memcpy (&stats, &shared->slots [i], sizeof (stats)) ;
+    rtStatsPrint (&stats, histogram) ;
+  }
+
+  munmap (shared, sizeof (struct rtStatsShared)) ;
+  return 0 ;
+}
+
+
+/*
+ * wiringPiRtStatsDump:
+ *	Print the statistics of program pid, or of every program collecting
+ *	them when pid is 0. Returns the number of programs printed.
+ *********************************************************************************
+ */
+
+int wiringPiRtStatsDump (int pid, int histogram)
+{
+  struct dirent *entry ;
+  DIR *dir ;
+  int found = 0 ;
+
+  if (pid != 0)
+    return (rtStatsDumpPid (pid, histogram) == 0) ? 1 : 0 ;
+
+  if ((dir = opendir ("/dev/shm")) == NULL)
+    return 0 ;
+
+  while ((entry = readdir (dir)) != NULL)
+    if (strncmp (entry->d_name, "wiringpi_rtstats.", 17) == 0)
+      if (rtStatsDumpPid (atoi (entry->d_name + 17), histogram) == 0)
+        ++found ;
+
+  closedir (dir) ;
+  return found ;
+}
@@ -23,8 +23,8 @@
  */
 
 #include <stdio.h>
-#include <malloc.h>
 #include <pthread.h>
+#include <stdatomic.h>
 
 #include "wiringPi.h"
 #include "softPwm.h"
@@ -42,56 +42,131 @@
 //	of 100 and a range of 100 gives a period of 100 * 100 = 10,000 µS
 //	which is a frequency of 100Hz.
 //
-//	It's possible to get a higher frequency by lowering the pulse time,
-//	however CPU uage will skyrocket as wiringPi uses a hard-loop to time
-//	periods under 100µS - this is because the Linux timer calls are just
-//	not accurate at all, and have an overhead.
-//
-//	Another way to increase the frequency is to reduce the range - however
-//	that reduces the overall output accuracy...
+//	All channels are serviced by a single thread and share one period, the
+//	one of the largest range in use. A channel with a smaller range keeps
+//	its duty cycle (mark / range) but runs at that common frequency.
 
 #define	PULSE_TIME	100
 
-static volatile int marks         [MAX_PINS] ;
-static volatile int range         [MAX_PINS] ;
-static volatile pthread_t threads [MAX_PINS] ;
-static volatile int newPin = -1 ;
+// marks and range are written by softPwmWrite/Create/Stop and read by the
+//	PWM thread without locking. The list of active pins is guarded by
+//	pwmLock and copied by the thread at the start of every period.
+
+static atomic_int marks [MAX_PINS] ;
+static atomic_int range [MAX_PINS] ;
+static int        levels [MAX_PINS] ;	// Last level written, only touched by the thread while the pin is active
+
+static pthread_mutex_t pwmLock = PTHREAD_MUTEX_INITIALIZER ;
+static pthread_cond_t  pwmCond = PTHREAD_COND_INITIALIZER ;
+static pthread_t       pwmThread ;
+static int             threadRunning = FALSE ;
+static int             activePins [MAX_PINS] ;
+static int             activeCount = 0 ;
+static unsigned int    periodCount = 0 ;	// Periods started by the thread
 
 
 /*
  * softPwmThread:
- *	Thread to do the actual PWM output
+ *	One thread does the PWM output for every active pin. Each period all
+ *	pins with a mark go high together, then the falling edges are sorted
+ *	(as in softServoThread) and the thread sleeps from one to the next.
+ *	Pins are only written when their level changes, so 0% and 100% cost
+ *	nothing.
  *********************************************************************************
  */
 
 static void *softPwmThread (void *arg)
 {
-  int pin, mark, space ;
-  struct sched_param param ;
-
-  param.sched_priority = sched_get_priority_max (SCHED_RR) ;
-  pthread_setschedparam (pthread_self (), SCHED_RR, &param) ;
+  register int i, j, k, m ;
+  int pin, count, maxRange, tmp ;
+  int myPins [MAX_PINS] ;
+  int myRanges [MAX_PINS] ;
+  unsigned long long myEdges [MAX_PINS] ;
+  unsigned long long start, period, edge ;
 
-  pin = *((int *)arg) ;
-  free (arg) ;
+  (void)arg ;
 
-  pin    = newPin ;
-  newPin = -1 ;
+  piRtApply (WPI_RT_SOFTPWM) ;
+  wiringPiRtStatsThread ("softPwm") ;
 
-  piHiPri (90) ;
+  start = piNanos64 () ;
 
   for (;;)
   {
-    mark  = marks [pin] ;
-    space = range [pin] - mark ;
+    pthread_mutex_lock (&pwmLock) ;
+    ++periodCount ;
+    pthread_cond_broadcast (&pwmCond) ;		// Wake softPwmStop waiting for the pin to be dropped
+    if (activeCount == 0)
+    {
+      while (activeCount == 0)
+	pthread_cond_wait (&pwmCond, &pwmLock) ;
+      start = piNanos64 () ;
+    }
+    count = activeCount ;
+    for (i = 0 ; i < count ; ++i)
+    {
+      myPins   [i] = activePins [i] ;
+      myRanges [i] = atomic_load_explicit (&range [myPins [i]], memory_order_relaxed) ;
+    }
+    pthread_mutex_unlock (&pwmLock) ;
+
+    maxRange = 0 ;
+    for (i = 0 ; i < count ; ++i)
+      if (myRanges [i] > maxRange)
+	maxRange = myRanges [i] ;
+    period = (unsigned long long)maxRange * PULSE_TIME * 1000 ;
+
+    for (i = 0 ; i < count ; ++i)
+      myEdges [i] = (unsigned long long)atomic_load_explicit (&marks [myPins [i]], memory_order_relaxed) * period / myRanges [i] ;
+
+// Sort the falling edges (& pins), earliest first
+
+    for (m = count / 2 ; m > 0 ; m /= 2)
+      for (j = m ; j < count ; ++j)
+	for (i = j - m ; i >= 0 ; i -= m)
+	{
+	  k = i + m ;
+	  if (myEdges [k] >= myEdges [i])
+	    break ;
+	  else // Swap
+	  {
+	    edge = myEdges [i] ; myEdges [i] = myEdges [k] ; myEdges [k] = edge ;
+	    tmp  = myPins  [i] ; myPins  [i] = myPins  [k] ; myPins  [k] = tmp ;
+	  }
+	}
+
+// All on, except the ones with no mark
+
+    for (i = 0 ; i < count ; ++i)
+    {
+      pin = myPins [i] ;
+      tmp = (myEdges [i] > 0) ? HIGH : LOW ;
+      if (levels [pin] != tmp)
+      {
+	digitalWrite (pin, tmp) ;
+	levels [pin] = tmp ;
+      }
+    }
 
-    if (mark != 0)
-      digitalWrite (pin, HIGH) ;
-    delayMicroseconds (mark * 100) ;
+// Now turn them off in order, full marks stay on
 
-    if (space != 0)
+    for (i = 0 ; i < count ; ++i)
+    {
+      if ((myEdges [i] == 0) || (myEdges [i] >= period))
+	continue ;
+      pin = myPins [i] ;
+      delayUntilNanos (start + myEdges [i]) ;
       digitalWrite (pin, LOW) ;
-    delayMicroseconds (space * 100) ;
+      levels [pin] = LOW ;
+    }
+
+// Start the next period on time, or now if we overran it
+
+    start += period ;
+    if (start < piNanos64 ())
+      start = piNanos64 () ;
+    else
+      delayUntilNanos (start) ;
   }
 
   return NULL ;
@@ -108,58 +183,63 @@ void softPwmWrite (int pin, int value)
 {
   if (pin < MAX_PINS)
   {
+    int pinRange = atomic_load_explicit (&range [pin], memory_order_relaxed) ;
+
     /**/ if (value < 0)
       value = 0 ;
-    else if (value > range [pin])
-      value = range [pin] ;
+    else if (value > pinRange)
+      value = pinRange ;
 
-    marks [pin] = value ;
+    atomic_store_explicit (&marks [pin], value, memory_order_relaxed) ;
   }
 }
 
 
 /*
  * softPwmCreate:
- *	Create a new softPWM thread.
+ *	Add a pin to the softPWM thread, starting the thread for the first one.
  *********************************************************************************
  */
 
 int softPwmCreate (int pin, int initialValue, int pwmRange)
 {
-  int res ;
-  pthread_t myThread ;
-  int *passPin ;
+  int res = 0 ;
 
   if (pin >= MAX_PINS)
     return -1 ;
 
-  if (range [pin] != 0)	// Already running on this pin
-    return -1 ;
-
   if (pwmRange <= 0)
     return -1 ;
 
-  passPin = malloc (sizeof (*passPin)) ;
-  if (passPin == NULL)
+  pthread_mutex_lock (&pwmLock) ;
+
+  if (atomic_load (&range [pin]) != 0)	// Already running on this pin
+  {
+    pthread_mutex_unlock (&pwmLock) ;
     return -1 ;
+  }
+
+  if (!threadRunning)
+  {
+    res = pthread_create (&pwmThread, NULL, softPwmThread, NULL) ;
+    if (res != 0)
+    {
+      pthread_mutex_unlock (&pwmLock) ;
+      return res ;
+    }
+    threadRunning = TRUE ;
+  }
 
   digitalWrite (pin, LOW) ;
   pinMode      (pin, OUTPUT) ;
+  levels [pin] = LOW ;
 
-  marks [pin] = initialValue ;
-  range [pin] = pwmRange ;
-
-  *passPin = pin ;
-  newPin   = pin ;
-  res      = pthread_create (&myThread, NULL, softPwmThread, (void *)passPin) ;
+  atomic_store (&range [pin], pwmRange) ;
+  softPwmWrite (pin, initialValue) ;
 
-  if (res != 0)
-    return res ;
-  
-  while (newPin != -1)
-    delay (1) ;
-
-  threads [pin] = myThread ;
+  activePins [activeCount++] = pin ;
+  pthread_cond_broadcast (&pwmCond) ;
+  pthread_mutex_unlock (&pwmLock) ;
 
   return res ;
 }
@@ -167,20 +247,37 @@ int softPwmCreate (int pin, int initialValue, int pwmRange)
 
 /*
  * softPwmStop:
- *	Stop an existing softPWM thread
+ *	Drop a pin from the softPWM thread. Waits for the thread to start a
+ *	new period without it so the pin is not written again afterwards.
+ *	The thread itself stays around, idle, for the next softPwmCreate.
  *********************************************************************************
  */
 
 void softPwmStop (int pin)
 {
+  int i ;
+  unsigned int period ;
+
   if (pin < MAX_PINS)
   {
-    if (range [pin] != 0)
+    pthread_mutex_lock (&pwmLock) ;
+    if (atomic_load (&range [pin]) != 0)
     {
-      pthread_cancel (threads [pin]) ;
-      pthread_join   (threads [pin], NULL) ;
-      range [pin] = 0 ;
+      for (i = 0 ; i < activeCount ; ++i)
+	if (activePins [i] == pin)
+	{
+	  activePins [i] = activePins [--activeCount] ;
+	  break ;
+	}
+      atomic_store (&range [pin], 0) ;
+      atomic_store (&marks [pin], 0) ;
+
+      period = periodCount ;
+      while (periodCount == period)
+	pthread_cond_wait (&pwmCond, &pwmLock) ;
+
       digitalWrite (pin, LOW) ;
     }
+    pthread_mutex_unlock (&pwmLock) ;
   }
 }
@@ -25,8 +25,6 @@
 
 //#include <stdio.h>
 #include <string.h>
-#include <time.h>
-#include <sys/time.h>
 #include <pthread.h>
 
 #include "wiringPi.h"
@@ -84,17 +82,14 @@ static PI_THREAD (softServoThread)
   int myDelays [MAX_SERVOS] ;
   int myPins   [MAX_SERVOS] ;
 
-  struct timeval  tNow, tStart, tPeriod, tGap, tTotal ;
-  struct timespec tNs ;
+  unsigned long long slot ;
 
-  tTotal.tv_sec  =    0 ;
-  tTotal.tv_usec = 8000 ;
-
-  piHiPri (50) ;
+  piRtApply (WPI_RT_SOFTSERVO) ;
+  wiringPiRtStatsThread ("softServo") ;
 
+  slot = piNanos64 () ;
   for (;;)
   {
-    gettimeofday (&tStart, NULL) ;
 
     memcpy (myDelays, pulseWidth, sizeof (myDelays)) ;
     memcpy (myPins,   pinMap,     sizeof (myPins)) ;
@@ -141,12 +136,11 @@ static PI_THREAD (softServoThread)
 
 // Wait until the end of an 8mS time-slot
 
-    gettimeofday (&tNow, NULL) ;
-    timersub (&tNow, &tStart, &tPeriod) ;
-    timersub (&tTotal, &tPeriod, &tGap) ;
-    tNs.tv_sec  = tGap.tv_sec ;
-    tNs.tv_nsec = tGap.tv_usec * 1000 ;
-    nanosleep (&tNs, NULL) ;
+    slot += 8000000ULL ;
+    if (slot < piNanos64 ())	// Overran the slot, start the next one now
+      slot = piNanos64 () ;
+    else
+      delayUntilNanos (slot) ;
   }
 
   return NULL ;
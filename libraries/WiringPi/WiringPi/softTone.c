@@ -51,30 +51,44 @@ static int newPin = -1 ;
 static PI_THREAD (softToneThread)
 {
   int pin, freq, halfPeriod ;
-  struct sched_param param ;
-
-  param.sched_priority = sched_get_priority_max (SCHED_RR) ;
-  pthread_setschedparam (pthread_self (), SCHED_RR, &param) ;
+  unsigned long long edge, now ;
+  char name [WPI_RTSTATS_NAME] ;
 
   pin    = newPin ;
   newPin = -1 ;
 
-  piHiPri (50) ;
+  piRtApply (WPI_RT_SOFTTONE) ;
+
+  snprintf (name, sizeof (name), "softTone %d", pin) ;
+  wiringPiRtStatsThread (name) ;
+
+// Edges are timed against absolute deadlines so the tone does not drift
+//	flat by the time spent writing the pin, after a stall the next edge is
+//	re-anchored to now instead of firing the missed ones back to back
 
+  edge = piNanos64 () ;
   for (;;)
   {
     freq = freqs [pin] ;
     if (freq == 0)
+    {
       delay (1) ;
+      edge = piNanos64 () ;
+    }
     else
     {
       halfPeriod = 500000 / freq ;
+      now = piNanos64 () ;
+      if (edge < now)
+        edge = now ;
 
       digitalWrite (pin, HIGH) ;
-      delayMicroseconds (halfPeriod) ;
+      edge += (unsigned long long)halfPeriod * 1000ULL ;
+      delayUntilNanos (edge) ;
 
       digitalWrite (pin, LOW) ;
-      delayMicroseconds (halfPeriod) ;
+      edge += (unsigned long long)halfPeriod * 1000ULL ;
+      delayUntilNanos (edge) ;
     }
   }
 
@@ -0,0 +1,75 @@
+// WiringPi test program: GPIO v2 line groups and digitalWriteMask via GPIO device
+// Compile: gcc -Wall wiringpi_test10_device_group.c -o wiringpi_test10_device_group -lwiringPi
+
+#include "wpi_test.h"
+
+// Need BCM19 <-> BCM26 and BCM18 <-> BCM17 connected
+const int GPIOOUT0 = 19;
+const int GPIOIN0 = 26;
+const int GPIOOUT1 = 18;
+const int GPIOIN1 = 17;
+
+
+void CheckGroupIn(int groupIn, unsigned long long expect) {
+	unsigned long long values = 0;
+	delayMicroseconds(5000);
+	CheckSame("group read", wiringPiGroupRead(groupIn, 3, &values), 0);
+	CheckSame("group in", (int)values, (int)expect);
+}
+
+
+int main (void) {
+
+	printf("WiringPi GPIO test program 10 (line groups on BCM GPIO%d/%d (output) and GPIO%d/%d (input) via GPIO device)\n",
+		GPIOOUT0, GPIOOUT1, GPIOIN0, GPIOIN1);
+
+	if (wiringPiSetupGpioDevice(WPI_PIN_BCM) == -1) {
+		printf("wiringPiSetupGpioDevice failed\n\n");
+		exit(EXIT_FAILURE);
+	}
+
+	const int outPins[] = { GPIOOUT0, GPIOOUT1 };
+	const int inPins[] = { GPIOIN0, GPIOIN1 };
+	int groupOut = wiringPiGroupRequest(outPins, 2, OUTPUT);
+	int groupIn = wiringPiGroupRequest(inPins, 2, INPUT);
+	CheckNotSame("output group", groupOut, -1);
+	CheckNotSame("input group", groupIn, -1);
+	CheckSame("line already grouped", wiringPiGroupRequest(outPins, 1, INPUT), -1);
+
+	printf("\nTest group write\n");
+	wiringPiGroupWrite(groupOut, 3, 0);
+	CheckGroupIn(groupIn, 0);
+	wiringPiGroupWrite(groupOut, 3, 1);
+	CheckGroupIn(groupIn, 1);
+	wiringPiGroupWrite(groupOut, 2, 2);
+	CheckGroupIn(groupIn, 3);
+	wiringPiGroupWrite(groupOut, 1, 0);
+	CheckGroupIn(groupIn, 2);
+
+	printf("\nTest single pins of a group\n");
+	digitalWriteEx(GPIOOUT0, GPIOIN0, HIGH);
+	digitalWriteEx(GPIOOUT1, GPIOIN1, LOW);
+	CheckGroupIn(groupIn, 1);
+
+	printf("\nTest digitalWriteMask\n");
+	wiringPiGroupRelease(groupOut);
+	digitalWriteMask(1u << GPIOOUT1, 1u << GPIOOUT0);
+	CheckGroupIn(groupIn, 2);
+	digitalWriteMask(1u << GPIOOUT0, 1u << GPIOOUT1);
+	CheckGroupIn(groupIn, 1);
+	digitalWriteMask(0, 1u << GPIOOUT0);
+	CheckGroupIn(groupIn, 0);
+
+	printf("\nTest digitalWriteMask with a line requested on its own\n");
+	pinMode(GPIOOUT0, OUTPUT);
+	digitalWriteMask(1u << GPIOOUT0, 1u << GPIOOUT1);
+	CheckGroupIn(groupIn, 1);
+	digitalWriteMask(1u << GPIOOUT1, 1u << GPIOOUT0);
+	CheckGroupIn(groupIn, 2);
+
+	wiringPiGroupRelease(groupIn);
+	pinMode(GPIOOUT0, INPUT);
+	pinMode(GPIOOUT1, INPUT);
+
+	return UnitTestState();
+}
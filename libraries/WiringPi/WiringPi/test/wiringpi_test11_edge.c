@@ -0,0 +1,105 @@
+// WiringPi test program: timestamped edge events via GPIO v2 line requests and the ISR dispatcher
+// Compile: gcc -Wall wiringpi_test11_edge.c -o wiringpi_test11_edge -lwiringPi
+
+#include "wpi_test.h"
+
+// Need BCM19 <-> BCM26 connected
+int GPIO = 19;
+int GPIOIN = 26;
+
+
+static void CountEdge(struct wpiEdgeEvent *event, void *context) {
+	if (event->edge == INT_EDGE_RISING) {
+		(*(volatile int *)context)++;
+	}
+}
+
+
+int main (void) {
+	struct wpiEdgeEvent events[16];
+
+	printf("WiringPi GPIO test program 11 (edge events on GPIO%d (output) and GPIO%d (input))\n", GPIO, GPIOIN);
+
+	if (wiringPiSetupGpio() == -1) {
+		printf("wiringPiSetupGpio failed\n\n");
+		exit(EXIT_FAILURE);
+	}
+	pinMode(GPIO, OUTPUT);
+	digitalWrite(GPIO, LOW);
+
+	int fd = wiringPiEdgeOpen(GPIOIN, INT_EDGE_BOTH, 0);
+	CheckNotSame("edge fd", fd, -1);
+	CheckSame("nothing queued", wiringPiEdgeRead(fd, events, 16, 0), 0);
+
+	printf("\nTest burst of 5 pulses, read in one batch\n");
+	for (int i = 0; i < 5; i++) {
+		digitalWrite(GPIO, HIGH);
+		delayMicroseconds(200);
+		digitalWrite(GPIO, LOW);
+		delayMicroseconds(200);
+	}
+	delay(10);
+	int count = wiringPiEdgeRead(fd, events, 16, 100);
+	CheckSame("events", count, 10);
+	for (int i = 0; i < count; i++) {
+		CheckSame("edge", events[i].edge, (i % 2) ? INT_EDGE_FALLING : INT_EDGE_RISING);
+		CheckSame("missed", events[i].missed, 0);
+		CheckSame("pin", events[i].pin, GPIOIN);
+		if (i > 0) {
+			CheckSame("seqno", events[i].seqno, events[i-1].seqno + 1);
+			double us = (events[i].timestamp - events[i-1].timestamp) / 1000.0;
+			CheckSameDouble("edge interval us", us, 200.0, 150.0);
+		}
+	}
+
+	printf("\nTest timeout\n");
+	CheckSame("timeout", wiringPiEdgeRead(fd, events, 16, 50), 0);
+
+	wiringPiEdgeClose(fd);
+
+	printf("\nTest ISR with context\n");
+	volatile int rising = 0;
+	unsigned int start = micros();
+	CheckSame("register", wiringPiISRContext(GPIOIN, INT_EDGE_BOTH, CountEdge, (void *)&rising), 0);
+	CheckSameDouble("register time ms", (micros() - start) / 1000.0, 0.0, 10.0);
+	for (int i = 0; i < 3; i++) {
+		digitalWrite(GPIO, HIGH);
+		delay(5);
+		digitalWrite(GPIO, LOW);
+		delay(5);
+	}
+	delay(20);
+	CheckSame("rising edges", rising, 3);
+	wiringPiISRStop(GPIOIN);
+
+	printf("\nTest ISR with INT_EDGE_SETUP, keeps both edges\n");
+	rising = 0;
+	CheckSame("register", wiringPiISRContext(GPIOIN, INT_EDGE_SETUP, CountEdge, (void *)&rising), 0);
+	for (int i = 0; i < 2; i++) {
+		digitalWrite(GPIO, HIGH);
+		delay(5);
+		digitalWrite(GPIO, LOW);
+		delay(5);
+	}
+	delay(20);
+	CheckSame("rising edges", rising, 2);
+
+	printf("\nTest registering again replaces the function\n");
+	volatile int replaced = 0;
+	rising = 0;
+	CheckSame("register again", wiringPiISRContext(GPIOIN, INT_EDGE_RISING, CountEdge, (void *)&replaced), 0);
+	for (int i = 0; i < 2; i++) {
+		digitalWrite(GPIO, HIGH);
+		delay(5);
+		digitalWrite(GPIO, LOW);
+		delay(5);
+	}
+	delay(20);
+	CheckSame("old function", rising, 0);
+	CheckSame("new function", replaced, 2);
+	wiringPiISRStop(GPIOIN);
+
+	pinMode(GPIO, INPUT);
+
+	return UnitTestState();
+}
@@ -69,6 +69,7 @@
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
 #include <asm/ioctl.h>
 #include <byteswap.h>
 #include <sys/utsname.h>
@@ -93,6 +94,16 @@
 
 struct wiringPiNodeStruct *wiringPiNodes = NULL ;
 
+// Pin to node lookup: a sparse two level table, pages of NODE_PAGE_SIZE pins
+//	are only allocated once a node covers them. Pins beyond the table, which
+//	no extension uses in practice, fall back to walking the list.
+
+#define	NODE_PAGE_BITS	12
+#define	NODE_PAGE_SIZE	(1 << NODE_PAGE_BITS)
+#define	NODE_PAGES	4096
+
+static struct wiringPiNodeStruct **nodePages [NODE_PAGES] ;
+
 // BCM Magic
 
 #define	BCM_PASSWORD		0x5A000000
@@ -422,11 +433,13 @@ const int piMemorySize [8] =
 
 static uint64_t epochMilli, epochMicro ;
 
+// How much earlier than a deadline delayUntilNanos wakes up from sleep to
+//	spin the rest, calibrated by delayCalibrate.
+static long long delaySlackNs = 80000 ;
+
 // Misc
 
 static int wiringPiMode = WPI_MODE_UNINITIALISED ;
-static volatile int    pinPass = -1 ;
-static pthread_mutex_t pinMutex ;
 
 static int RaspberryPiModel  = -1;
 static int RaspberryPiLayout = -1;
@@ -464,11 +477,41 @@ static int isrFds [64] =
   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
 } ;
 
+// GPIO v2 multi-line requests, see wiringPiGroupRequest
+#define	MAX_LINE_GROUPS	8
+
+struct lineGroupStruct
+{
+  int fd ;
+  int count ;	// 0 when the slot is free
+  int weak ;	// released, not refused, when one of its lines is requested on its own
+  int gpios [GPIO_V2_LINES_MAX] ;
+} ;
+
+static struct lineGroupStruct lineGroups [MAX_LINE_GROUPS] ;
+static int lineGroupOf  [64] ;	// group index + 1 holding the BCM GPIO, 0 for none
+static int lineGroupBit [64] ;	// and its bit in that group's values
+
 // ISR Data
 static int chipFd = -1;
+
+// ISR dispatcher, the tables are indexed by BCM GPIO and guarded by isrLock
+static pthread_mutex_t isrLock = PTHREAD_MUTEX_INITIALIZER ;
+static pthread_t isrDispatcher ;
+static int isrEpollFd = -1 ;
+static int isrEdgeFds [64] =
+{
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+} ;
 static void (*isrFunctions [64])(void) ;
-static pthread_t isrThreads[64];
-static int isrMode[64];
+static void (*isrContextFunctions [64])(struct wpiEdgeEvent *, void *) ;
+static void *isrContexts [64] ;
+static int edgeModes [64] ;	// edges last requested by wiringPiEdgeOpen, INT_EDGE_SETUP for none yet
+static int isrDispatching = -1 ;	// BCM GPIO whose function the dispatcher is calling right now
+static pthread_cond_t isrIdle = PTHREAD_COND_INITIALIZER ;	// signalled when it returns
 
 // Doing it the Arduino way with lookup tables...
 //	Yes, it's probably more innefficient than all the bit-twidling, but it
@@ -1571,14 +1614,21 @@ void gpioClockSet (int pin, int freq)
 
 /*
  * wiringPiFindNode:
- *      Locate our device node
+ *      Locate our device node, O(1) through the lookup table
  *********************************************************************************
  */
 
 struct wiringPiNodeStruct *wiringPiFindNode (int pin)
 {
+  struct wiringPiNodeStruct **page ;
   struct wiringPiNodeStruct *node = wiringPiNodes ;
 
+  if ((pin >= 0) && ((pin >> NODE_PAGE_BITS) < NODE_PAGES))
+  {
+    page = nodePages [pin >> NODE_PAGE_BITS] ;
+    return (page == NULL) ? NULL : page [pin & (NODE_PAGE_SIZE - 1)] ;
+  }
+
   while (node != NULL)
     if ((pin >= node->pinBase) && (pin <= node->pinMax))
       return node ;
@@ -1615,7 +1665,7 @@ struct wiringPiNodeStruct *wiringPiNewNode (int pinBase, int numPins)
   if (pinBase < 64)
     (void)wiringPiFailure (WPI_FATAL, "wiringPiNewNode: pinBase of %d is < 64\n", pinBase) ;
 
-// Check all pins in-case there is overlap:
+// Check all pins in-case there is overlap, one table lookup per pin:
 
   for (pin = pinBase ; pin < (pinBase + numPins) ; ++pin)
     if (wiringPiFindNode (pin) != NULL)
@@ -1639,6 +1689,19 @@ struct wiringPiNodeStruct *wiringPiNewNode (int pinBase, int numPins)
   node->next             = wiringPiNodes ;
   wiringPiNodes          = node ;
 
+// Enter the pins into the lookup table
+
+  for (pin = pinBase ; (pin <= node->pinMax) && ((pin >> NODE_PAGE_BITS) < NODE_PAGES) ; ++pin)
+  {
+    if (nodePages [pin >> NODE_PAGE_BITS] == NULL)
+    {
+      nodePages [pin >> NODE_PAGE_BITS] = (struct wiringPiNodeStruct **)calloc (NODE_PAGE_SIZE, sizeof (struct wiringPiNodeStruct *)) ;
+      if (nodePages [pin >> NODE_PAGE_BITS] == NULL)
+	(void)wiringPiFailure (WPI_FATAL, "wiringPiNewNode: Unable to allocate memory: %s\n", strerror (errno)) ;
+    }
+    nodePages [pin >> NODE_PAGE_BITS][pin & (NODE_PAGE_SIZE - 1)] = node ;
+  }
+
   return node ;
 }
 
@@ -1731,6 +1794,14 @@ void releaseLine(int pin) {
 int requestLine(int pin, unsigned int lineRequestFlags) {
   struct gpiohandle_request rq;
 
+  if (lineGroupOf[pin]) {
+    // a line can only be held by one request
+    if (!lineGroups[lineGroupOf[pin]-1].weak) {
+      fprintf(stderr, "requestLine: pin %d is held by line group %d\n", pin, lineGroupOf[pin]-1);
+      return -1;  // error
+    }
+    wiringPiGroupRelease(lineGroupOf[pin]-1);
+  }
    if (lineFds[pin]>=0) {
     if (lineRequestFlags == lineFlags[pin]) {
       //already requested
@@ -1761,6 +1832,165 @@ int requestLine(int pin, unsigned int lineRequestFlags) {
   return lineFds[pin];
 }
 
+/*
+ * wiringPiGroupRequest:
+ *	Request several lines in one GPIO v2 line request (GPIO_V2_GET_LINE_IOCTL),
+ *	so they can be read and written together with a single ioctl. Pins are
+ *	numbered as in the current mode, bit i of the values is pins[i]. Works
+ *	in every mode as long as the gpiochip device can be opened, no root needed.
+ *	Grouped pins keep working with digitalRead/digitalWrite, but can not be
+ *	requested on their own (pinMode) until the group is released.
+ *	Returns the group number or -1.
+ *********************************************************************************
+ */
+
+static int lineGroupRequestGpios(const int *gpios, int count, int mode, unsigned long long values, int weak) {
+  struct gpio_v2_line_request req;
+  int group, i, gpio;
+
+  if (count <= 0 || count > GPIO_V2_LINES_MAX || (mode != INPUT && mode != OUTPUT)) {
+    fprintf(stderr, "wiringPiGroupRequest: invalid request of %d lines, mode %d\n", count, mode);
+    return -1;
+  }
+  for (group = 0 ; group < MAX_LINE_GROUPS ; ++group) {
+    if (lineGroups[group].count == 0)
+      break;
+  }
+  if (group == MAX_LINE_GROUPS) {
+    fprintf(stderr, "wiringPiGroupRequest: all %d line groups in use\n", MAX_LINE_GROUPS);
+    return -1;
+  }
+  for (i = 0 ; i < count ; ++i) {
+    gpio = gpios[i];
+    if (gpio < 0 || gpio > 63) {
+      fprintf(stderr, "wiringPiGroupRequest: invalid gpio %d\n", gpio);
+      return -1;
+    }
+    if (lineGroupOf[gpio]) {
+      if (!lineGroups[lineGroupOf[gpio]-1].weak) {
+        fprintf(stderr, "wiringPiGroupRequest: gpio %d is held by line group %d\n", gpio, lineGroupOf[gpio]-1);
+        return -1;
+      }
+      wiringPiGroupRelease(lineGroupOf[gpio]-1);
+    }
+  }
+  if (wiringPiGpioDeviceGetFd()<0) {
+    return -1;  // error
+  }
+  for (i = 0 ; i < count ; ++i) {
+    if (lineFds[gpios[i]]>=0) {
+      releaseLine(gpios[i]);
+    }
+  }
+
+  memset(&req, 0, sizeof(req));
+  for (i = 0 ; i < count ; ++i) {
+    req.offsets[i] = gpios[i];
+  }
+  req.num_lines = count;
+  strncpy(req.consumer, "wiringpi", sizeof(req.consumer) - 1);
+  req.config.flags = (mode == OUTPUT) ? GPIO_V2_LINE_FLAG_OUTPUT : GPIO_V2_LINE_FLAG_INPUT;
+  if (mode == OUTPUT) {
+    req.config.num_attrs = 1;
+    req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+    req.config.attrs[0].attr.values = values;
+    req.config.attrs[0].mask = (count == 64) ? ~0ULL : (1ULL << count) - 1;
+  }
+  int ret = ioctl(chipFd, GPIO_V2_GET_LINE_IOCTL, &req);
+  if (ret || req.fd<0) {
+    ReportDeviceError("get line", gpios[0], "wiringPiGroupRequest", ret);
+    return -1;  // error
+  }
+
+  lineGroups[group].fd = req.fd;
+  lineGroups[group].count = count;
+  lineGroups[group].weak = weak;
+  for (i = 0 ; i < count ; ++i) {
+    lineGroups[group].gpios[i] = gpios[i];
+    lineGroupOf[gpios[i]] = group + 1;
+    lineGroupBit[gpios[i]] = i;
+  }
+  if (wiringPiDebug)
+    printf ("wiringPiGroupRequest: group %d, %d lines, fd :%d\n", group, count, req.fd) ;
+  return group;
+}
+
+static int groupPinToGpio(int pin) {
+  if (pin < 0 || pin > 63)
+    return -1;
+  switch(wiringPiMode) {
+    case WPI_MODE_PINS:
+    case WPI_MODE_GPIO_DEVICE_WPI:
+      return pinToGpio[pin];
+    case WPI_MODE_PHYS:
+    case WPI_MODE_GPIO_DEVICE_PHYS:
+      return physToGpio[pin];
+    default:
+      return pin;
+  }
+}
+
+int wiringPiGroupRequest(const int *pins, int count, int mode) {
+  int gpios[GPIO_V2_LINES_MAX];
+  int i;
+
+  if (count <= 0 || count > GPIO_V2_LINES_MAX) {
+    fprintf(stderr, "wiringPiGroupRequest: invalid request of %d lines\n", count);
+    return -1;
+  }
+  for (i = 0 ; i < count ; ++i) {
+    gpios[i] = groupPinToGpio(pins[i]);
+  }
+  return lineGroupRequestGpios(gpios, count, mode, 0, FALSE);
+}
+
+void wiringPiGroupRelease(int group) {
+  int i;
+
+  if (group < 0 || group >= MAX_LINE_GROUPS || lineGroups[group].count == 0)
+    return;
+  if (wiringPiDebug)
+    printf ("wiringPiGroupRelease: group %d\n", group) ;
+  close(lineGroups[group].fd);
+  for (i = 0 ; i < lineGroups[group].count ; ++i) {
+    lineGroupOf[lineGroups[group].gpios[i]] = 0;
+  }
+  lineGroups[group].count = 0;
+}
+
+// sets the lines whose bits are in mask to the matching bits of values
+int wiringPiGroupWrite(int group, unsigned long long mask, unsigned long long values) {
+  struct gpio_v2_line_values data;
+
+  if (group < 0 || group >= MAX_LINE_GROUPS || lineGroups[group].count == 0)
+    return -1;
+  data.mask = mask;
+  data.bits = values;
+  int ret = ioctl(lineGroups[group].fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &data);
+  if (ret) {
+    ReportDeviceError("set line values", lineGroups[group].gpios[0], "wiringPiGroupWrite", ret);
+    return -1;  // error
+  }
+  return 0;
+}
+
+// reads the lines whose bits are in mask, the other bits of values are 0
+int wiringPiGroupRead(int group, unsigned long long mask, unsigned long long *values) {
+  struct gpio_v2_line_values data;
+
+  if (group < 0 || group >= MAX_LINE_GROUPS || lineGroups[group].count == 0)
+    return -1;
+  data.mask = mask;
+  data.bits = 0;
+  int ret = ioctl(lineGroups[group].fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &data);
+  if (ret) {
+    ReportDeviceError("get line values", lineGroups[group].gpios[0], "wiringPiGroupRead", ret);
+    return -1;  // error
+  }
+  *values = data.bits & mask;
+  return 0;
+}
+
 /*
  *********************************************************************************
  * Core Functions
@@ -2138,6 +2368,14 @@ void pullUpDnControl (int pin, int pud)
 
 int digitalReadDevice (int pin) {   // INPUT and OUTPUT should work
 
+  if (lineGroupOf[pin]) {
+    unsigned long long values;
+    unsigned long long bit = 1ULL << lineGroupBit[pin];
+    if (wiringPiGroupRead(lineGroupOf[pin]-1, bit, &values)) {
+      return LOW;  // error
+    }
+    return values ? HIGH : LOW;
+  }
    if (lineFds[pin]<0) {
     // line not requested - auto request on first read as input
     pinModeDevice(pin, INPUT);
@@ -2235,6 +2473,11 @@ void digitalWriteDevice (int pin, int value) {
   if (wiringPiDebug)
     printf ("digitalWriteDevice: ioctl pin:%d value: %d\n", pin, value) ;
 
+  if (lineGroupOf[pin]) {
+    unsigned long long bit = 1ULL << lineGroupBit[pin];
+    wiringPiGroupWrite(lineGroupOf[pin]-1, bit, value == LOW ? 0 : bit);
+    return;
+  }
   if (lineFds[pin]<0) {
     // line not requested - auto request on first write as output
     pinModeDevice(pin, OUTPUT);
@@ -2307,6 +2550,110 @@ void digitalWrite (int pin, int value)
 }
 
 
+/*
+ * digitalWriteMask:
+ *	Set and clear several BCM GPIOs (0-31) at once, independent of the pin
+ *	numbering mode. Memory mapped this is one store to the clear register
+ *	and one to the set register (GPCLR0/GPSET0, or the RP1 RIO CLR/SET
+ *	aliases on a Pi 5), clear first, so pins changing from high to low and
+ *	low to high never overlap high. In device mode lines that are not
+ *	requested yet go into a new GPIO v2 line group, so declare them all in
+ *	the first call (e.g. clear them all) to have them written together.
+ *	Lines already held by a group or by pinMode are written where they
+ *	are, one ioctl per group for the cleared lines and then for the set
+ *	ones. pinMode on one of them drops its group again.
+ *********************************************************************************
+ */
+
+// writes value to pins with one ioctl per line group holding some of them,
+// lines requested on their own are written one by one
+static void digitalWriteMaskLines (unsigned int pins, int value) {
+  unsigned long long bits[MAX_LINE_GROUPS] = { 0 };
+  int pin, group;
+
+  for (pin = 0 ; pin < 32 ; ++pin) {
+    if (pins & (1u << pin)) {
+      if (lineGroupOf[pin]) {
+        bits[lineGroupOf[pin]-1] |= 1ULL << lineGroupBit[pin];
+      } else {
+        digitalWriteDevice(pin, value);
+      }
+    }
+  }
+  for (group = 0 ; group < MAX_LINE_GROUPS ; ++group) {
+    if (bits[group]) {
+      wiringPiGroupWrite(group, bits[group], value == LOW ? 0 : bits[group]);
+    }
+  }
+}
+
+static void digitalWriteMaskDevice (unsigned int setMask, unsigned int clearMask) {
+  unsigned long long bits = 0;
+  unsigned int fresh = 0;
+  int gpios[32];
+  int pin, count = 0;
+
+  // lines nobody holds yet get a group of their own, lines already in use are
+  // never released and requested again, that would leave them undriven for a moment
+  for (pin = 0 ; pin < 32 ; ++pin) {
+    if (((setMask | clearMask) & (1u << pin)) && !lineGroupOf[pin] && lineFds[pin] < 0) {
+      if (setMask & (1u << pin)) {
+        bits |= 1ULL << count;
+      }
+      gpios[count++] = pin;
+      fresh |= 1u << pin;
+    }
+  }
+  setMask &= ~fresh;
+  clearMask &= ~fresh;
+
+  if (wiringPiDebug)
+    printf ("digitalWriteMaskDevice: ioctl set:0x%08X clear:0x%08X new:0x%08X\n", setMask, clearMask, fresh) ;
+
+  // two writes like the clear and set registers, a single ioctl does not
+  // promise any order between the lines it changes
+  digitalWriteMaskLines(clearMask, LOW);
+  if (count && lineGroupRequestGpios(gpios, count, OUTPUT, bits, TRUE) < 0) {
+    return;  // error
+  }
+  digitalWriteMaskLines(setMask, HIGH);
+}
+
+void digitalWriteMask (unsigned int setMask, unsigned int clearMask)
+{
+  clearMask &= ~setMask;
+  if ((setMask | clearMask) == 0)
+    return ;
+
+  switch(wiringPiMode) {
+    default: //WPI_MODE_GPIO_SYS
+      fprintf(stderr, "digitalWriteMask: invalid mode\n");
+      return;
+    case WPI_MODE_GPIO_DEVICE_BCM:
+    case WPI_MODE_GPIO_DEVICE_WPI:
+    case WPI_MODE_GPIO_DEVICE_PHYS:
+      digitalWriteMaskDevice(setMask, clearMask);
+      return;
+    case WPI_MODE_PINS:
+    case WPI_MODE_PHYS:
+    case WPI_MODE_GPIO:
+      break;
+  }
+
+  if (PI_MODEL_5 == RaspberryPiModel) {
+    if (clearMask)
+      rio[RP1_RIO_OUT + RP1_CLR_OFFSET] = clearMask;
+    if (setMask)
+      rio[RP1_RIO_OUT + RP1_SET_OFFSET] = setMask;
+  } else {
+    if (clearMask)
+      *(gpio + gpioToGPCLR [0]) = clearMask ;
+    if (setMask)
+      *(gpio + gpioToGPSET [0]) = setMask ;
+  }
+}
+
+
 /*
  * digitalWrite8:
  *	Set an output 8-bit byte on the device from the given pin number
@@ -2616,7 +2963,6 @@ int waitForInterruptInit (int pin, int mode)
   }
 
   /* open gpio */
-  sleep(1);
   if (wiringPiGpioDeviceGetFd()<0) {
     return -1;
   }
@@ -2673,22 +3019,9 @@ int waitForInterruptInit (int pin, int mode)
 
 int waitForInterruptClose (int pin) {
   if (isrFds[pin]>0) {
-    if (wiringPiDebug) {
-      printf ("wiringPi: waitForInterruptClose close thread 0x%lX\n", (unsigned long)isrThreads[pin]) ;
-    }
-    if (pthread_cancel(isrThreads[pin]) == 0) {
-      if (wiringPiDebug) {
-        printf ("wiringPi: waitForInterruptClose thread canceled successfuly\n") ;
-      }
-    } else {
-     if (wiringPiDebug) {
-        fprintf (stderr, "wiringPi: waitForInterruptClose could not cancel thread\n");
-      }
-    }
     close(isrFds [pin]);
   }
   isrFds [pin] = -1;
-  isrFunctions [pin] = NULL;
 
   /* -not closing so far - other isr may be using it - only close if no other is using - will code later
   if (chipFd>0) {
@@ -2703,61 +3036,103 @@ int waitForInterruptClose (int pin) {
 }
 
 
-int wiringPiISRStop (int pin) {
-  return waitForInterruptClose (pin);
-}
-
 /*
- * interruptHandler:
- *	This is a thread and gets started to wait for the interrupt we're
- *	hoping to catch. It will call the user-function when the interrupt
- *	fires.
+ * isrDispatchThread:
+ *	One thread serves every wiringPiISR/wiringPiISRContext pin: it waits
+ *	on an epoll set of their edge event fds and calls the pin's function
+ *	once per edge. Functions are called without holding isrLock, so they
+ *	may register or stop ISRs themselves. The time from the edge to its
+ *	function being called is its lateness in the real-time statistics.
  *********************************************************************************
  */
 
-static void *interruptHandler (UNU void *arg)
+static void *isrDispatchThread (UNU void *arg)
 {
-  int pin ;
-
-  (void)piHiPri (55) ;	// Only effective if we run as root
+  struct epoll_event ready [16] ;
+  struct wpiEdgeEvent events [16] ;
+  void (*function)(void) ;
+  void (*contextFunction)(struct wpiEdgeEvent *, void *) ;
+  void *context ;
+  int i, j, n, count, gpio ;
 
-  pin   = pinPass ;
-  pinPass = -1 ;
+  (void)piRtApply (WPI_RT_ISR) ;	// Scheduling only takes effect if we run as root
+  wiringPiRtStatsThread ("isr dispatcher") ;
 
   for (;;) {
-    int ret = waitForInterrupt(pin, -1);
-    if ( ret> 0) {
-      if (wiringPiDebug) {
-        printf ("wiringPi: call function\n") ;
-      }
-      if(isrFunctions [pin]) {
-        isrFunctions [pin] () ;
-      }
-      // wait again - in the past forever - now can be stopped by  waitForInterruptClose
-    } else if( ret< 0) {
-      break; // stop thread!
+    n = epoll_wait (isrEpollFd, ready, 16, -1) ;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue ;
+      fprintf (stderr, "wiringPi: ISR dispatcher epoll_wait failed: %s\n", strerror (errno)) ;
+      break ;
     }
-  }
+    for (i = 0 ; i < n ; ++i) {
+      gpio = ready [i].data.u32 ;
+      pthread_mutex_lock (&isrLock) ;
+      count = (isrEdgeFds [gpio] >= 0) ? wiringPiEdgeRead (isrEdgeFds [gpio], events, 16, 0) : 0 ;
+      pthread_mutex_unlock (&isrLock) ;
+
+// The function is looked up again for every event, so one stopped or
+//	replaced from inside a callback is never called with its old context
+
+      for (j = 0 ; j < count ; ++j) {
+        pthread_mutex_lock (&isrLock) ;
+        if (isrEdgeFds [gpio] < 0) {
+          pthread_mutex_unlock (&isrLock) ;
+          break ;
+        }
+        function        = isrFunctions [gpio] ;
+        contextFunction = isrContextFunctions [gpio] ;
+        context         = isrContexts [gpio] ;
+        isrDispatching  = gpio ;
+        pthread_mutex_unlock (&isrLock) ;
 
-  waitForInterruptClose (pin);
-  if (wiringPiDebug) {
-    printf ("wiringPi: interruptHandler finished\n") ;
+        wiringPiRtStatsRecord (events [j].timestamp, piNanos64 (), events [j].missed) ;
+        if (wiringPiDebug) {
+          printf ("wiringPi: call function for line %d\n", gpio) ;
+        }
+        if (contextFunction)
+          contextFunction (&events [j], context) ;
+        else if (function)
+          function () ;
+
+        pthread_mutex_lock (&isrLock) ;
+        isrDispatching = -1 ;
+        pthread_cond_broadcast (&isrIdle) ;
+        pthread_mutex_unlock (&isrLock) ;
+      }
+    }
   }
   return NULL ;
 }
 
 
 /*
- * wiringPiISR:
+ * wiringPiISRContext:
  *	Pi Specific.
- *	Take the details and create an interrupt handler that will do a call-
- *	back to the user supplied function.
+ *	Call function with the edge event and context for every edge on pin.
+ *	Registration only requests the line and adds it to the dispatcher's
+ *	epoll set, the dispatcher thread is started with the first one.
  *********************************************************************************
  */
 
-int wiringPiISR (int pin, int mode, void (*function)(void))
+// Waits, with isrLock held, until the dispatcher is not calling gpio's
+//	function, so its context can be freed or replaced afterwards. Not from
+//	the dispatcher itself, that is a callback stopping or replacing itself.
+
+static void isrWaitIdle (int gpio)
+{
+  if (isrEpollFd >= 0 && pthread_equal (pthread_self (), isrDispatcher))
+    return ;
+  while (isrDispatching == gpio)
+    pthread_cond_wait (&isrIdle, &isrLock) ;
+}
+
+static int isrRegister (int pin, int mode, void (*function)(void), void (*contextFunction)(struct wpiEdgeEvent *, void *), void *context)
 {
-  const int maxpin = GetMaxPin();
+  const int maxpin = GetMaxPin() ;
+  struct epoll_event watch ;
+  int gpio, fd ;
 
   if (pin < 0 || pin > maxpin)
     return wiringPiFailure (WPI_FATAL, "wiringPiISR: pin must be 0-%d (%d)\n", maxpin, pin) ;
@@ -2766,42 +3141,67 @@ int wiringPiISR (int pin, int mode, void (*function)(void))
   if (wiringPiDebug) {
     printf ("wiringPi: wiringPiISR pin %d, mode %d\n", pin, mode) ;
   }
-  if (isrFunctions [pin]) {
-    printf ("wiringPi: ISR function alread active, ignoring \n") ;
-  }
 
-  isrFunctions [pin] = function ;
-  isrMode[pin] = mode;
-  if(waitForInterruptInit (pin, mode)<0) {
-    if (wiringPiDebug) {
-      fprintf (stderr, "wiringPi: waitForInterruptInit failed\n") ;
-    }
-  };
+  gpio = groupPinToGpio (pin) ;
+  if (gpio < 0 || gpio > 63)
+    return -1 ;
 
-  if (wiringPiDebug) {
-    printf ("wiringPi: mutex in\n") ;
-  }
-  pthread_mutex_lock (&pinMutex) ;
-    pinPass = pin ;
-    if (wiringPiDebug) {
-      printf("wiringPi: pthread_create before 0x%lX\n", (unsigned long)isrThreads[pin]);
-    }
-    if (pthread_create (&isrThreads[pin], NULL, interruptHandler, NULL)==0) {
-      if (wiringPiDebug) {
-        printf("wiringPi: pthread_create successed, 0x%lX\n", (unsigned long)isrThreads[pin]);
-      }
-      while (pinPass != -1)
-        delay (1) ;
+  pthread_mutex_lock (&isrLock) ;
+  if (isrEdgeFds [gpio] >= 0) {
+// Registering again replaces the function, as it always did, and the
+//	edges unless mode is INT_EDGE_SETUP or the same
+
+    isrWaitIdle (gpio) ;
+    if (mode != INT_EDGE_SETUP && mode != edgeModes [gpio]) {
+      // the line has to be released before it can be requested with other edges
+      epoll_ctl (isrEpollFd, EPOLL_CTL_DEL, isrEdgeFds [gpio], NULL) ;
+      wiringPiEdgeClose (isrEdgeFds [gpio]) ;
+      isrEdgeFds          [gpio] = -1 ;
+      isrFunctions        [gpio] = NULL ;
+      isrContextFunctions [gpio] = NULL ;
+      isrContexts         [gpio] = NULL ;
     } else {
-      if (wiringPiDebug) {
-        printf("wiringPi: pthread_create failed\n");
-      }
+      isrFunctions        [gpio] = function ;
+      isrContextFunctions [gpio] = contextFunction ;
+      isrContexts         [gpio] = context ;
+      pthread_mutex_unlock (&isrLock) ;
+      return 0 ;
     }
+  }
 
-    if (wiringPiDebug) {
-      printf ("wiringPi: mutex out\n") ;
+  if (isrEpollFd < 0) {
+    isrEpollFd = epoll_create1 (EPOLL_CLOEXEC) ;
+    if (isrEpollFd < 0 || pthread_create (&isrDispatcher, NULL, isrDispatchThread, NULL) != 0) {
+      fprintf (stderr, "wiringPi: could not start the ISR dispatcher: %s\n", strerror (errno)) ;
+      if (isrEpollFd >= 0)
+        close (isrEpollFd) ;
+      isrEpollFd = -1 ;
+      pthread_mutex_unlock (&isrLock) ;
+      return -1 ;
     }
-  pthread_mutex_unlock (&pinMutex) ;
+  }
+
+  fd = wiringPiEdgeOpen (pin, mode, 0) ;
+  if (fd < 0) {
+    pthread_mutex_unlock (&isrLock) ;
+    return -1 ;
+  }
+  isrFunctions        [gpio] = function ;
+  isrContextFunctions [gpio] = contextFunction ;
+  isrContexts         [gpio] = context ;
+  isrEdgeFds              [gpio] = fd ;
+
+  watch.events   = EPOLLIN ;
+  watch.data.u64 = 0 ;
+  watch.data.u32 = gpio ;
+  if (epoll_ctl (isrEpollFd, EPOLL_CTL_ADD, fd, &watch) != 0) {
+    fprintf (stderr, "wiringPi: could not watch line %d: %s\n", gpio, strerror (errno)) ;
+    wiringPiEdgeClose (fd) ;
+    isrEdgeFds [gpio] = -1 ;
+    pthread_mutex_unlock (&isrLock) ;
+    return -1 ;
+  }
+  pthread_mutex_unlock (&isrLock) ;
 
   if (wiringPiDebug) {
     printf ("wiringPi: wiringPiISR finished\n") ;
@@ -2809,6 +3209,197 @@ int wiringPiISR (int pin, int mode, void (*function)(void))
   return 0 ;
 }
 
+int wiringPiISRContext (int pin, int mode, void (*function)(struct wpiEdgeEvent *event, void *context), void *context)
+{
+  return isrRegister (pin, mode, NULL, function, context) ;
+}
+
+
+/*
+ * wiringPiISR:
+ *	Pi Specific.
+ *	Take the details and have the ISR dispatcher call back the user
+ *	supplied function on every edge. Calling it again for the same pin
+ *	replaces the function, and the edges if mode differs.
+ *********************************************************************************
+ */
+
+int wiringPiISR (int pin, int mode, void (*function)(void))
+{
+  return isrRegister (pin, mode, function, NULL, NULL) ;
+}
+
+
+/*
+ * wiringPiISRStop:
+ *	Stop calling the function for pin. Returns once a call already under
+ *	way has finished, so its context may be freed then, unless called from
+ *	the function itself (which returns to the dispatcher afterwards).
+ *********************************************************************************
+ */
+
+int wiringPiISRStop (int pin)
+{
+  int gpio = groupPinToGpio (pin) ;
+
+  if (gpio < 0 || gpio > 63)
+    return -1 ;
+
+  pthread_mutex_lock (&isrLock) ;
+  if (isrEdgeFds [gpio] >= 0) {
+    epoll_ctl (isrEpollFd, EPOLL_CTL_DEL, isrEdgeFds [gpio], NULL) ;
+    wiringPiEdgeClose (isrEdgeFds [gpio]) ;
+  }
+  isrEdgeFds              [gpio] = -1 ;
+  isrFunctions        [gpio] = NULL ;
+  isrContextFunctions [gpio] = NULL ;
+  isrContexts         [gpio] = NULL ;
+  isrWaitIdle (gpio) ;
+  pthread_mutex_unlock (&isrLock) ;
+
+  if (wiringPiDebug) {
+    printf ("wiringPi: wiringPiISRStop finished\n") ;
+  }
+  return 0 ;
+}
+
+
+/*
+ * wiringPiEdgeOpen:
+ *	Edge events with their kernel timestamps, on GPIO v2 line requests.
+ *	Each pin is its own one line request, so the kernel queues up to
+ *	EDGE_BUFFER_SIZE events for it (its default would be 16), stamped in
+ *	the interrupt handler, and wiringPiEdgeRead drains as many as fit in
+ *	one read, so bursts between two reads are not lost and each edge keeps
+ *	the time it happened rather than the time it was read. debounceUs > 0
+ *	enables the kernel debounce filter. INT_EDGE_SETUP reuses the edges
+ *	last requested on the line, both edges the first time. Returns a
+ *	nonblocking fd that can also be watched with poll/epoll, or -1.
+ *********************************************************************************
+ */
+
+#define	EDGE_BUFFER_SIZE	1024	// the most the kernel buffers for one request (GPIO_V2_LINES_MAX * 16)
+#define	EDGE_READ_BATCH		64
+
+static int          edgePins [64] ;		// pin number as given to wiringPiEdgeOpen, by BCM GPIO
+static unsigned int edgeLineSeqno [64] ;	// last line_seqno seen, by BCM GPIO
+
+int wiringPiEdgeOpen (int pin, int mode, unsigned int debounceUs)
+{
+  struct gpio_v2_line_request req ;
+  int gpio = groupPinToGpio (pin) ;
+
+  if (gpio < 0 || gpio > 63) {
+    fprintf (stderr, "wiringPiEdgeOpen: invalid pin %d\n", pin) ;
+    return -1 ;
+  }
+  if (wiringPiGpioDeviceGetFd () < 0) {
+    return -1 ;
+  }
+
+  memset (&req, 0, sizeof (req)) ;
+  req.offsets [0] = gpio ;
+  req.num_lines = 1 ;
+  req.event_buffer_size = EDGE_BUFFER_SIZE ;
+  strncpy (req.consumer, "wiringpi_edge", sizeof (req.consumer) - 1) ;
+  req.config.flags = GPIO_V2_LINE_FLAG_INPUT ;
+
+// INT_EDGE_SETUP used to keep the edges set up beforehand with the gpio
+//	program, the character device keeps nothing between requests, so it
+//	reuses the edges last requested here and both edges for a new line
+
+  if (mode == INT_EDGE_SETUP)
+    mode = (edgeModes [gpio] != INT_EDGE_SETUP) ? edgeModes [gpio] : INT_EDGE_BOTH ;
+  switch (mode) {
+    case INT_EDGE_FALLING:
+      req.config.flags |= GPIO_V2_LINE_FLAG_EDGE_FALLING ;
+      break ;
+    case INT_EDGE_RISING:
+      req.config.flags |= GPIO_V2_LINE_FLAG_EDGE_RISING ;
+      break ;
+    case INT_EDGE_BOTH:
+      req.config.flags |= GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING ;
+      break ;
+    default:
+      fprintf (stderr, "wiringPiEdgeOpen: invalid mode %d\n", mode) ;
+      return -1 ;
+  }
+  if (debounceUs > 0) {
+    req.config.num_attrs = 1 ;
+    req.config.attrs [0].attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE ;
+    req.config.attrs [0].attr.debounce_period_us = debounceUs ;
+    req.config.attrs [0].mask = 1 ;
+  }
+
+  int ret = ioctl (chipFd, GPIO_V2_GET_LINE_IOCTL, &req) ;
+  if (ret || req.fd < 0) {
+    ReportDeviceError ("get line", gpio, "wiringPiEdgeOpen", ret) ;
+    return -1 ;
+  }
+  fcntl (req.fd, F_SETFL, fcntl (req.fd, F_GETFL) | O_NONBLOCK) ;
+
+  edgePins [gpio] = pin ;
+  edgeLineSeqno [gpio] = 0 ;
+  edgeModes [gpio] = mode ;
+  if (wiringPiDebug) {
+    printf ("wiringPi: edge events on line %d, mode %d, debounce %u us, fd=%d\n", gpio, mode, debounceUs, req.fd) ;
+  }
+  return req.fd ;
+}
+
+
+/*
+ * wiringPiEdgeRead:
+ *	Read up to maxEvents queued edges, waiting up to mS for the first one
+ *	(-1 forever, 0 not at all). Returns the number of events, 0 on timeout
+ *	or -1 on error. missed counts edges the kernel had to drop before each
+ *	event because its queue was full.
+ *********************************************************************************
+ */
+
+int wiringPiEdgeRead (int fd, struct wpiEdgeEvent *events, int maxEvents, int mS)
+{
+  struct gpio_v2_line_event buffer [EDGE_READ_BATCH] ;
+  struct pollfd polls ;
+  ssize_t bytes ;
+  int i, count ;
+
+  if (maxEvents <= 0)
+    return 0 ;
+  if (maxEvents > EDGE_READ_BATCH)
+    maxEvents = EDGE_READ_BATCH ;
+
+  bytes = read (fd, buffer, maxEvents * sizeof (buffer [0])) ;
+  if (bytes < 0 && errno == EAGAIN && mS != 0) {
+    polls.fd      = fd ;
+    polls.events  = POLLIN | POLLERR ;
+    polls.revents = 0 ;
+    int ret = poll (&polls, 1, mS) ;
+    if (ret <= 0)
+      return ret ;
+    bytes = read (fd, buffer, maxEvents * sizeof (buffer [0])) ;
+  }
+  if (bytes < 0)
+    return (errno == EAGAIN) ? 0 : -1 ;
+
+  count = bytes / sizeof (buffer [0]) ;
+  for (i = 0 ; i < count ; ++i) {
+    unsigned int gpio = buffer [i].offset & 63 ;
+    events [i].timestamp = buffer [i].timestamp_ns ;
+    events [i].seqno     = buffer [i].line_seqno ;
+    events [i].missed    = edgeLineSeqno [gpio] ? buffer [i].line_seqno - edgeLineSeqno [gpio] - 1 : 0 ;
+    events [i].pin       = edgePins [gpio] ;
+    events [i].edge      = (buffer [i].id == GPIO_V2_LINE_EVENT_RISING_EDGE) ? INT_EDGE_RISING : INT_EDGE_FALLING ;
+    edgeLineSeqno [gpio] = buffer [i].line_seqno ;
+  }
+  return count ;
+}
+
+int wiringPiEdgeClose (int fd)
+{
+  return close (fd) ;
+}
+
 
 /*
  * initialiseEpoch:
@@ -2832,6 +3423,7 @@ static void initialiseEpoch (void)
   epochMilli = (uint64_t)ts.tv_sec * (uint64_t)1000    + (uint64_t)(ts.tv_nsec / 1000000L) ;
   epochMicro = (uint64_t)ts.tv_sec * (uint64_t)1000000 + (uint64_t)(ts.tv_nsec /    1000L) ;
 #endif
+  delayCalibrate () ;
 }
 
 
@@ -2867,38 +3459,139 @@ void delay (unsigned int howLong)
  *
  *      Plan B: It seems all might not be well with that plan, so changing it
  *      to use gettimeofday () and poll on that instead...
+ *
+ *	Plan C: longer delays sleep to an absolute deadline minus the
+ *	calibrated wake-up latency and only spin the rest, see delayUntilNanos.
+ *	The spin is capped at the short delay limit here, so a delay of a few
+ *	hundred microseconds does not burn a core for all of it.
  *********************************************************************************
  */
 
+#define	DELAY_SPIN_MAX_NS	100000LL
+
+static void delayUntilNanosSlack (unsigned long long deadline, long long slack) ;
+
 void delayMicrosecondsHard (unsigned int howLong)
 {
-  struct timeval tNow, tLong, tEnd ;
-
-  gettimeofday (&tNow, NULL) ;
-  tLong.tv_sec  = howLong / 1000000 ;
-  tLong.tv_usec = howLong % 1000000 ;
-  timeradd (&tNow, &tLong, &tEnd) ;
+  unsigned long long deadline = piNanos64 () + (unsigned long long)howLong * 1000ULL ;
 
-  while (timercmp (&tNow, &tEnd, <))
-    gettimeofday (&tNow, NULL) ;
+  while (piNanos64 () < deadline)
+    ;
 }
 
 void delayMicroseconds (unsigned int howLong)
 {
-  struct timespec sleeper ;
-  unsigned int uSecs = howLong % 1000000 ;
-  unsigned int wSecs = howLong / 1000000 ;
-
   /**/ if (howLong ==   0)
     return ;
   else if (howLong  < 100)
     delayMicrosecondsHard (howLong) ;
   else
+    delayUntilNanosSlack (piNanos64 () + (unsigned long long)howLong * 1000ULL,
+      (delaySlackNs < DELAY_SPIN_MAX_NS) ? delaySlackNs : DELAY_SPIN_MAX_NS) ;
+}
+
+
+/*
+ * piNanos64:
+ *	CLOCK_MONOTONIC in nanoseconds. Not relative to the wiringPi epoch, so
+ *	it can be compared with kernel timestamps like wpiEdgeEvent.timestamp.
+ *********************************************************************************
+ */
+
+unsigned long long piNanos64 (void)
+{
+  struct timespec ts ;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts) ;
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec ;
+}
+
+
+/*
+ * delayUntilNanos:
+ *	Wait until an absolute piNanos64 deadline. Sleeps with clock_nanosleep
+ *	(TIMER_ABSTIME) until the calibrated slack before the deadline, then
+ *	spins on the (vDSO) monotonic clock, so the wake-up is neither late by
+ *	the scheduler latency nor burns the CPU for the whole wait. Periodic
+ *	threads should advance their deadline by the period instead of
+ *	sleeping relative to now, so the error does not accumulate.
+ *	Threads named with wiringPiRtStatsThread get every wait recorded.
+ *********************************************************************************
+ */
+
+static void delayUntilNanosSlack (unsigned long long deadline, long long slack)
+{
+  struct timespec sleeper ;
+  unsigned long long now = piNanos64 () ;
+  unsigned long long wake ;
+  int missed ;
+
+  if (deadline > now + (unsigned long long)slack)
   {
-    sleeper.tv_sec  = wSecs ;
-    sleeper.tv_nsec = (long)(uSecs * 1000L) ;
-    nanosleep (&sleeper, NULL) ;
+    wake = deadline - (unsigned long long)slack ;
+    sleeper.tv_sec  = (time_t)(wake / 1000000000ULL) ;
+    sleeper.tv_nsec = (long)(wake % 1000000000ULL) ;
+    while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &sleeper, NULL) == EINTR)
+      ;
+    now = piNanos64 () ;
   }
+  missed = now > deadline ;	// Called too late, or the sleep overran the slack
+  while (now < deadline)
+    now = piNanos64 () ;
+
+  wiringPiRtStatsRecord (deadline, now, missed) ;
+}
+
+void delayUntilNanos (unsigned long long deadline)
+{
+  delayUntilNanosSlack (deadline, delaySlackNs) ;
+}
+
+
+/*
+ * delayCalibrate:
+ *	Measure how late clock_nanosleep wakes up the calling thread and use
+ *	that (90th percentile plus a margin) as the spin slack. Done once at
+ *	setup, real-time threads can call it again once their priority is set
+ *	since they wake up with much less latency. Returns the slack in ns.
+ *********************************************************************************
+ */
+
+#define	DELAY_CALIBRATE_SAMPLES	16
+
+long long delayCalibrate (void)
+{
+  struct timespec sleeper ;
+  long long late [DELAY_CALIBRATE_SAMPLES], tmp ;
+  unsigned long long deadline ;
+  int i, j ;
+
+  for (i = 0 ; i < DELAY_CALIBRATE_SAMPLES ; ++i)
+  {
+    deadline = piNanos64 () + 200000ULL ;
+    sleeper.tv_sec  = (time_t)(deadline / 1000000000ULL) ;
+    sleeper.tv_nsec = (long)(deadline % 1000000000ULL) ;
+    while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &sleeper, NULL) == EINTR)
+      ;
+    late [i] = (long long)(piNanos64 () - deadline) ;
+  }
+
+  for (i = 1 ; i < DELAY_CALIBRATE_SAMPLES ; ++i)
+    for (j = i ; (j > 0) && (late [j - 1] > late [j]) ; --j)
+    {
+      tmp = late [j] ; late [j] = late [j - 1] ; late [j - 1] = tmp ;
+    }
+
+  tmp = late [DELAY_CALIBRATE_SAMPLES * 9 / 10] + 10000 ;
+  if (tmp < 10000)
+    tmp = 10000 ;
+  else if (tmp > 500000)
+    tmp = 500000 ;
+  delaySlackNs = tmp ;
+
+  if (wiringPiDebug)
+    printf ("wiringPi: delay slack calibrated to %lld ns\n", delaySlackNs) ;
+  return delaySlackNs ;
 }
 
 
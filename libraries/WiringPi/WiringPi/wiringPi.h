@@ -151,10 +151,9 @@ extern const int   piMemorySize    [ 8] ;
 // wiringPiNodeStruct:
 //	This describes additional device nodes in the extended wiringPi
 //	2.0 scheme of things.
-//	It's a simple linked list for now, but will hopefully migrate to
-//	a binary tree for efficiency reasons - but then again, the chances
-//	of more than 1 or 2 devices being added are fairly slim, so who
-//	knows....
+//	They are kept in a simple linked list, pin lookups go through a
+//	sparse table in wiringPi.c so dispatch does not depend on the number
+//	of devices added.
 
 struct wiringPiNodeStruct
 {
@@ -285,6 +284,13 @@ extern unsigned int  digitalReadByte     (void) ;
 extern unsigned int  digitalReadByte2    (void) ;
 extern          void digitalWriteByte    (int value) ;
 extern          void digitalWriteByte2   (int value) ;
+extern          void digitalWriteMask    (unsigned int setMask, unsigned int clearMask) ;  // BCM GPIO bits, Interface V3.10
+
+// GPIO v2 line groups, bit i of the values is pins [i]   Interface V3.10
+extern          int  wiringPiGroupRequest (const int *pins, int count, int mode) ;  // mode INPUT or OUTPUT, returns group or -1
+extern          int  wiringPiGroupWrite   (int group, unsigned long long mask, unsigned long long values) ;
+extern          int  wiringPiGroupRead    (int group, unsigned long long mask, unsigned long long *values) ;
+extern          void wiringPiGroupRelease (int group) ;
 
 // Interrupts
 //	(Also Pi hardware specific)
@@ -294,6 +300,24 @@ extern int  wiringPiISR         (int pin, int mode, void (*function)(void)) ;
 extern int  wiringPiISRStop     (int pin) ;  //V3.2
 extern int  waitForInterruptClose(int pin) ; //V3.2
 
+// Timestamped edge events   Interface V3.10
+
+struct wpiEdgeEvent
+{
+  unsigned long long timestamp ;	// ns, CLOCK_MONOTONIC, taken by the kernel when the edge happened
+  unsigned int       seqno ;		// per line, increments with every edge
+  unsigned int       missed ;		// edges dropped by the kernel before this one
+  int                pin ;
+  int                edge ;		// INT_EDGE_RISING or INT_EDGE_FALLING
+} ;
+
+extern int  wiringPiEdgeOpen    (int pin, int mode, unsigned int debounceUs) ;  // returns a pollable fd or -1
+extern int  wiringPiEdgeRead    (int fd, struct wpiEdgeEvent *events, int maxEvents, int mS) ;
+extern int  wiringPiEdgeClose   (int fd) ;
+
+// ISR with the edge event and a user context, served by the same dispatcher thread as wiringPiISR
+extern int  wiringPiISRContext  (int pin, int mode, void (*function)(struct wpiEdgeEvent *event, void *context), void *context) ;
+
 // Threads
 
 extern int  piThreadCreate      (void *(*fn)(void *)) ;
@@ -304,6 +328,18 @@ extern void piUnlock            (int key) ;
 
 extern int piHiPri (const int pri) ;
 
+// Real-time thread configuration, see piHiPri.c   Interface V3.10
+#define	WPI_RT_SOFTPWM		0
+#define	WPI_RT_SOFTTONE		1
+#define	WPI_RT_SOFTSERVO	2
+#define	WPI_RT_ISR		3
+#define	WPI_RT_USER		4	// WPI_RT_USER up to WPI_RT_SUBSYSTEMS-1 are the program's own
+#define	WPI_RT_SUBSYSTEMS	8
+
+extern int piRtConfigure  (int subsystem, int policy, int priority, unsigned long long cpuMask) ;
+extern int piRtLockMemory (unsigned int stackPrefault) ;
+extern int piRtApply      (int subsystem) ;
+
 // Extras from arduino land
 
 extern void         delay             (unsigned int howLong) ;
@@ -313,6 +349,35 @@ extern unsigned int micros            (void) ;
 
 extern unsigned long long piMicros64(void);   // Interface V3.7
 
+// Precision timing on CLOCK_MONOTONIC   Interface V3.10
+extern unsigned long long piNanos64      (void) ;
+extern void               delayUntilNanos (unsigned long long deadline) ;  // absolute piNanos64 time
+extern long long          delayCalibrate (void) ;  // returns the sleep slack in ns
+
+// Real-time thread wake-up statistics, see rtStats.c   Interface V3.10
+#define	WPI_RTSTATS_SLOTS	32
+#define	WPI_RTSTATS_NAME	32
+#define	WPI_RTSTATS_BUCKETS	128
+
+struct wpiRtStats
+{
+  char               name [WPI_RTSTATS_NAME] ;
+  int                tid ;
+  unsigned long long samples ;
+  unsigned long long missed ;		// deadlines passed before the thread woke up
+  unsigned long long totalLate ;	// ns
+  unsigned long long minLate ;		// ns
+  unsigned long long maxLate ;		// ns, maxLate - minLate is the jitter
+  unsigned long long buckets [WPI_RTSTATS_BUCKETS] ;
+} ;
+
+extern int                wiringPiRtStatsEnable     (int enable) ;  // or set WIRINGPI_RTSTATS
+extern void               wiringPiRtStatsThread     (const char *name) ;
+extern void               wiringPiRtStatsRecord     (unsigned long long deadline, unsigned long long now, unsigned int missed) ;
+extern int                wiringPiRtStatsGet        (int slot, struct wpiRtStats *stats) ;
+extern unsigned long long wiringPiRtStatsPercentile (const struct wpiRtStats *stats, double p) ;
+extern int                wiringPiRtStatsDump       (int pid, int histogram) ;  // pid 0: every program
+
 #ifdef __cplusplus
 }
 #endif
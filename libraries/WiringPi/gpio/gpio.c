@@ -82,7 +82,8 @@ char *usage = "Usage: gpio -v\n"
 	      "       gpio wb <value>\n"
 	      "       gpio usbp high/low\n"
 	      "       gpio gbr <channel>\n"
-	      "       gpio gbw <channel> <value>" ;	// No trailing newline needed here.
+	      "       gpio gbw <channel> <value>\n"
+	      "       gpio rtstats [-h] [pid]" ;	// No trailing newline needed here.
 
 
 #ifdef	NOT_FOR_NOW
@@ -377,6 +378,42 @@ static void doPadDrive (int argc, char *argv [])
 }
 
 
+/*
+ * doRtStats:
+ *	Dump the real-time thread statistics of a running program, or of
+ *	every program collecting them. -h adds the lateness histograms.
+ *	gpio rtstats [-h] [pid]
+ *********************************************************************************
+ */
+
+static void doRtStats (int argc, char *argv [])
+{
+  int histogram = FALSE, pid = 0, i ;
+
+  for (i = 2 ; i < argc ; ++i)
+  {
+    /**/ if (strcasecmp (argv [i], "-h") == 0)
+      histogram = TRUE ;
+    else if (isdigit (argv [i][0]) && pid == 0)
+      pid = atoi (argv [i]) ;
+    else
+    {
+      fprintf (stderr, "Usage: %s rtstats [-h] [pid]\n", argv [0]) ;
+      exit (1) ;
+    }
+  }
+
+  if (wiringPiRtStatsDump (pid, histogram) == 0)
+  {
+    if (pid != 0)
+      fprintf (stderr, "%s: no real-time statistics for pid %d\n", argv [0], pid) ;
+    else
+      fprintf (stderr, "%s: no program is collecting real-time statistics (set WIRINGPI_RTSTATS)\n", argv [0]) ;
+    exit (1) ;
+  }
+}
+
+
 /*
  * doUsbP:
  *	Control USB Power - High (1.2A) or Low (600mA)
@@ -996,6 +1033,10 @@ int main (int argc, char *argv [])
 
   if (strcasecmp (argv [1], "usbp"   ) == 0)	{ doUsbP   (argc, argv) ; return 0 ; }
 
+// Real-time statistics, read from shared memory so no setup is needed
+
+  if (strcasecmp (argv [1], "rtstats") == 0)	{ doRtStats (argc, argv) ; return 0 ; }
+
 // Gertboard commands
 
   if (strcasecmp (argv [1], "gbr" ) == 0)	{ doGbr (argc, argv) ; return 0 ; }
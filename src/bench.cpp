@@ -0,0 +1,358 @@
+#include "opencv2/imgcodecs.hpp"
+#include "opencv2/imgproc.hpp"
+#include "opencv2/videoio.hpp"
+#include "detector.hpp"
+#include "detection.hpp"
+#include "resolution.hpp"
+#include "camera.hpp"
+#include "preprocess.hpp"
+#include "motion.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <time.h>
+
+// Offline benchmark for the vision pipeline: runs FindTarget headless over a recorded
+// video, a directory of images or a V4L2 device and reports throughput and per-step latency.
+
+// feeds frames from a video file, the sorted contents of a directory or a V4L2 device
+// (e.g. the vivid test driver), the latter as luma straight from the driver buffers
+class FrameSource {
+public:
+
+	bool Open(const std::string& path, CameraSettings cameraSettings, FramePool& pool) {
+		if (path.starts_with("/dev/video")) {
+			cameraSettings.device = path;
+			camera = CreateCamera(cameraSettings, pool);
+			if (camera) {
+				std::cout << "camera: " << camera->Describe() << std::endl;
+			}
+			return camera != nullptr;
+		}
+		if (std::filesystem::is_directory(path)) {
+			for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(path)) {
+				if (entry.is_regular_file()) {
+					images.push_back(entry.path().string());
+				}
+			}
+			std::sort(images.begin(), images.end());
+			return images.size();
+		}
+		return video.open(path);
+	}
+
+	bool Read(cv::Mat& frame) {
+		if (camera) {
+			Clock::time_point captureTime;
+			return camera->Read(frame, captureTime);
+		}
+		if (!images.size()) {
+			return video.read(frame) && !frame.empty();
+		}
+		while (nextImage < images.size()) {
+			frame = cv::imread(images[nextImage++], cv::IMREAD_COLOR);
+			if (!frame.empty()) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+private:
+
+	std::unique_ptr<Camera> camera;
+	cv::VideoCapture video;
+	std::vector<std::string> images;
+	size_t nextImage = 0;
+};
+
+// collects per-frame samples of one step and reports percentiles in microseconds
+struct LatencySamples {
+
+	std::vector<double> samples;
+
+	void Add(Clock::duration duration) {
+		samples.push_back(std::chrono::duration<double, std::micro>(duration).count());
+	}
+
+	double Percentile(double p) const {
+		return samples[(size_t)(p * (samples.size() - 1) + 0.5)];
+	}
+
+	void Report(const char* name) {
+		std::sort(samples.begin(), samples.end());
+		std::cout << name << ": p50 " << Percentile(0.5) << " us, p90 " << Percentile(0.9)
+			<< " us, p99 " << Percentile(0.99) << " us, max " << samples.back() << " us" << std::endl;
+	}
+};
+
+struct BenchSettings {
+	std::string source;
+	std::string model;
+	DetectorSettings detector;
+	double scale = 1.0;
+	bool adaptive = false; // let a ResolutionController pick the scale instead
+	ResolutionSettings resolution;
+	CameraSettings camera; // for V4L2 sources
+	size_t maxFrames = SIZE_MAX;
+	TrackerSettings tracker;
+	bool fused = true; // false benchmarks the cvtColor, resize, equalizeHist sequence instead of the fused kernel
+	bool verify = false; // only compare the fused kernel against OpenCV, no detection
+	bool motionGate = false; // skip detection on static frames as ant does
+	MotionSettings motion;
+};
+
+// CPU time of the whole process, detection workers included
+static Clock::duration ProcessCpuTime() {
+	timespec now;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+	return std::chrono::seconds(now.tv_sec) + std::chrono::nanoseconds(now.tv_nsec);
+}
+
+static bool RunBenchmark(const std::string& engine, const BenchSettings& settings) {
+
+	std::unique_ptr<ObjectDetector> detector = CreateDetector(engine, settings.model, settings.detector);
+	if (!detector) {
+		std::cout << "failed to create " << engine << " detector!" << std::endl;
+		return false;
+	}
+
+	FramePool pool(4);
+	FrameSource source;
+	if (!source.Open(settings.source, settings.camera, pool)) {
+		std::cout << "failed to open " << settings.source << "!" << std::endl;
+		return false;
+	}
+
+	TargetTracker tracker(settings.tracker);
+	MotionGate motion(settings.motion);
+	MotionGate* gate = settings.motionGate ? &motion : nullptr;
+	ResolutionController controller(settings.resolution);
+	DetectResolution resolution { settings.scale };
+	resolution.fused = settings.fused;
+	double scaleTotal = 0.0;
+	std::vector<cv::Rect> faces;
+	faces.reserve(64);
+	DetectTimings timings;
+	LatencySamples readSamples, motionSamples, cvtColorSamples, resizeSamples, equalizeHistSamples, detectSamples, totalSamples;
+	size_t frames = 0, detections = 0, framesWithTarget = 0;
+	Clock::duration busy {}, cpu {};
+
+	cv::Mat frame;
+	Clock::time_point readStart = Clock::now();
+	while (frames < settings.maxFrames && source.Read(frame)) {
+		readSamples.Add(Clock::now() - readStart);
+		if (settings.adaptive) {
+			resolution = controller.Next();
+			resolution.fused = settings.fused;
+		}
+		Clock::duration cpuStart = ProcessCpuTime();
+		Clock::time_point start = Clock::now();
+		Target target = FindTarget(frame, *detector, tracker, gate, resolution, pool, faces, &timings);
+		Clock::duration total = Clock::now() - start;
+		cpu += ProcessCpuTime() - cpuStart;
+		if (!gate || !gate->Skipped()) {
+			controller.Update(total, tracker);
+		}
+		busy += total;
+		scaleTotal += resolution.scale;
+		frames++;
+		detections += timings.detections;
+		framesWithTarget += target.x != INT32_MAX;
+		motionSamples.Add(timings.motion);
+		cvtColorSamples.Add(timings.cvtColor);
+		resizeSamples.Add(timings.resize);
+		equalizeHistSamples.Add(timings.equalizeHist);
+		detectSamples.Add(timings.detect);
+		totalSamples.Add(total);
+		readStart = Clock::now();
+	}
+
+	if (!frames) {
+		std::cout << "no frames read from " << settings.source << "!" << std::endl;
+		return false;
+	}
+
+	double seconds = std::chrono::duration<double>(busy).count();
+	std::cout << "=== " << engine << " ===" << std::endl;
+	std::cout << frames << " frames, " << frames / seconds << " fps, "
+		<< (double)detections / frames << " detections per frame, "
+		<< framesWithTarget << " frames with a target" << std::endl;
+	std::cout << "cpu: " << std::chrono::duration<double, std::milli>(cpu).count() / frames << " ms per frame" << std::endl;
+	std::cout << "tracker: " << tracker.fullScans << " full scans, " << tracker.windowScans << " window scans, "
+		<< tracker.regionScans << " region scans, " << tracker.templateMatches << " template matches" << std::endl;
+	if (gate) {
+		std::cout << "motion: " << gate->skipped << " frames skipped, " << gate->regionFrames << " with regions, "
+			<< gate->fullFrames << " full" << std::endl;
+	}
+	readSamples.Report("read");
+	motionSamples.Report("motion");
+	cvtColorSamples.Report("cvtColor");
+	resizeSamples.Report("resize");
+	equalizeHistSamples.Report("equalizeHist");
+	detectSamples.Report("detect");
+	totalSamples.Report("total");
+
+	return true;
+}
+
+// Checks every SIMD level of the fused preprocessing kernel against cvtColor, resize
+// (INTER_LINEAR_EXACT) and equalizeHist on each frame, at every scale the resolution
+// controller can pick. test/preprocess_test does the same on synthetic frames.
+static bool VerifyPreprocess(const BenchSettings& settings) {
+
+	FramePool pool(4);
+	FrameSource source;
+	if (!source.Open(settings.source, settings.camera, pool)) {
+		std::cout << "failed to open " << settings.source << "!" << std::endl;
+		return false;
+	}
+
+	std::vector<double> scales { settings.scale };
+	for (double scale = settings.resolution.minScale; scale <= settings.resolution.maxScale; scale *= settings.resolution.step) {
+		scales.push_back(scale);
+	}
+	std::vector<SimdLevel> levels = AvailableSimd();
+	std::vector<size_t> mismatches(levels.size());
+	GrayPreprocessor preprocessor;
+	size_t frames = 0;
+
+	cv::Mat frame, gray, expected, result;
+	while (frames < settings.maxFrames && source.Read(frame)) {
+		if (frame.channels() == 3) {
+			cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+		}
+		else {
+			gray = frame;
+		}
+		for (double scale : scales) {
+			cv::Size size { cvRound(frame.cols / scale), cvRound(frame.rows / scale) };
+			cv::resize(gray, expected, size, 0, 0, cv::INTER_LINEAR_EXACT);
+			cv::equalizeHist(expected, expected);
+			for (size_t i = 0; i < levels.size(); i++) {
+				result.create(size, CV_8UC1);
+				preprocessor.Run(frame, result, levels[i]);
+				mismatches[i] += cv::countNonZero(result != expected);
+			}
+		}
+		frames++;
+	}
+
+	if (!frames) {
+		std::cout << "no frames read from " << settings.source << "!" << std::endl;
+		return false;
+	}
+
+	bool exact = true;
+	std::cout << "verified " << frames << " frames at " << scales.size() << " scales, dispatching to "
+		<< SimdName(DetectSimd()) << std::endl;
+	for (size_t i = 0; i < levels.size(); i++) {
+		std::cout << SimdName(levels[i]) << ": ";
+		if (mismatches[i]) {
+			std::cout << mismatches[i] << " pixels differ from OpenCV!" << std::endl;
+			exact = false;
+		}
+		else {
+			std::cout << "bit-exact" << std::endl;
+		}
+	}
+	return exact;
+}
+
+static void PrintUsage() {
+	std::cout << "usage: ant_bench <video file | image directory | /dev/videoN> [--engine haar,lbp,hog,dnn,multi] [--model file] "
+		"[--detect-threads count] [--detect-cpus list] [--mjpeg] [--jpeg-scale 1|2|4|8] [--scale factor | --adaptive [--budget ms]] [--frames count] [--full-scan] [--opencv-preprocess] [--verify] [--motion-gate [--motion-refresh frames]]" << std::endl;
+	std::cout << "several comma separated engines are benchmarked one after another on the same input" << std::endl;
+	std::cout << "--verify compares the fused preprocessing kernel with OpenCV instead of benchmarking" << std::endl;
+}
+
+int main(int argc, char** argv) {
+
+	if (argc < 2) {
+		PrintUsage();
+		return -1;
+	}
+
+	BenchSettings settings;
+	settings.source = argv[1];
+	std::string engines = "haar";
+
+	for (int i = 2; i < argc; i++) {
+		if (!strcmp(argv[i], "--engine") && i + 1 < argc) {
+			engines = argv[++i];
+		}
+		else if (!strcmp(argv[i], "--model") && i + 1 < argc) {
+			settings.model = argv[++i];
+		}
+		else if (!strcmp(argv[i], "--detect-threads") && i + 1 < argc) {
+			settings.detector.threads = strtoul(argv[++i], nullptr, 10);
+		}
+		else if (!strcmp(argv[i], "--detect-cpus") && i + 1 < argc && ParseCpuList(argv[i + 1], settings.detector.cpus)) {
+			i++;
+		}
+		else if (!strcmp(argv[i], "--mjpeg")) {
+			settings.camera.mjpeg = true;
+		}
+		else if (!strcmp(argv[i], "--jpeg-scale") && i + 1 < argc && strchr("1248", argv[i + 1][0]) && !argv[i + 1][1]) {
+			settings.camera.jpegScale = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "--scale") && i + 1 < argc) {
+			settings.scale = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "--adaptive")) {
+			settings.adaptive = true;
+		}
+		else if (!strcmp(argv[i], "--budget") && i + 1 < argc) {
+			settings.resolution.latencyBudget = std::chrono::milliseconds(strtol(argv[++i], nullptr, 10));
+		}
+		else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+			settings.maxFrames = strtoull(argv[++i], nullptr, 10);
+		}
+		else if (!strcmp(argv[i], "--full-scan")) {
+			settings.tracker.fullScanInterval = 0;
+		}
+		else if (!strcmp(argv[i], "--opencv-preprocess")) {
+			settings.fused = false;
+		}
+		else if (!strcmp(argv[i], "--verify")) {
+			settings.verify = true;
+		}
+		else if (!strcmp(argv[i], "--motion-gate")) {
+			settings.motionGate = true;
+		}
+		else if (!strcmp(argv[i], "--motion-refresh") && i + 1 < argc) {
+			settings.motion.refreshInterval = atoi(argv[++i]);
+		}
+		else {
+			PrintUsage();
+			return -1;
+		}
+	}
+
+	if (settings.model.size() && engines.find(',') != std::string::npos) {
+		std::cout << "--model can only be used with a single engine!" << std::endl;
+		return -1;
+	}
+
+	if (settings.verify) {
+		return VerifyPreprocess(settings) ? 0 : -1;
+	}
+
+	bool ok = true;
+	size_t begin = 0;
+	while (begin <= engines.size()) {
+		size_t end = std::min(engines.find(',', begin), engines.size());
+		ok = RunBenchmark(engines.substr(begin, end - begin), settings) && ok;
+		begin = end + 1;
+	}
+
+	return ok ? 0 : -1;
+}
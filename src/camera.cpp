@@ -0,0 +1,371 @@
+#include "camera.hpp"
+#include "jpeg_decoder.hpp"
+#include "opencv2/videoio.hpp"
+#include <linux/videodev2.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// formats whose first plane is 8 bit luma, best first, then compressed ones
+static const uint32_t luma_formats[] = {
+	V4L2_PIX_FMT_GREY,
+	V4L2_PIX_FMT_NV12,
+	V4L2_PIX_FMT_NV21,
+	V4L2_PIX_FMT_YUV420,
+	V4L2_PIX_FMT_YVU420,
+	V4L2_PIX_FMT_YUYV,
+	V4L2_PIX_FMT_MJPEG,
+};
+
+// keeps the recording from hitting the SD card once per frame
+constexpr size_t record_buffer_size = 1 << 20;
+
+constexpr int capture_timeout_ms = 2000;
+
+static int Ioctl(int fd, unsigned long request, void* arg) {
+	int result;
+	do {
+		result = ioctl(fd, request, arg);
+	} while (result < 0 && errno == EINTR);
+	return result;
+}
+
+static std::string FourccString(uint32_t fourcc) {
+	return { (char)(fourcc & 0xff), (char)(fourcc >> 8 & 0xff), (char)(fourcc >> 16 & 0xff), (char)(fourcc >> 24 & 0xff) };
+}
+
+// Device and mapped buffers, shared by the camera and every frame still referencing one
+// of the buffers, so frames may outlive the camera.
+struct V4l2Stream {
+
+	struct Buffer {
+		void* start = MAP_FAILED;
+		size_t length = 0;
+	};
+
+	int fd = -1;
+	std::vector<Buffer> buffers;
+	bool streaming = false;
+
+	~V4l2Stream() {
+		if (streaming) {
+			v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+			Ioctl(fd, VIDIOC_STREAMOFF, &type);
+		}
+		for (Buffer& buffer : buffers) {
+			if (buffer.start != MAP_FAILED) {
+				munmap(buffer.start, buffer.length);
+			}
+		}
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+
+	bool Queue(uint32_t index) {
+		v4l2_buffer buffer {};
+		buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buffer.memory = V4L2_MEMORY_MMAP;
+		buffer.index = index;
+		return Ioctl(fd, VIDIOC_QBUF, &buffer) == 0;
+	}
+};
+
+// Gives a driver buffer back to the driver when the last cv::Mat wrapping it is
+// released. Matrices only point at it through their UMatData, allocations for them
+// (Mat::create with another size) go to OpenCV's default allocator.
+class CaptureBufferAllocator : public cv::MatAllocator {
+public:
+
+	struct Lease {
+		std::shared_ptr<V4l2Stream> stream;
+		uint32_t index;
+	};
+
+	cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, cv::AccessFlag flags,
+		cv::UMatUsageFlags usageFlags) const override {
+		return cv::Mat::getDefaultAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+	}
+
+	bool allocate(cv::UMatData* data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override {
+		return cv::Mat::getDefaultAllocator()->allocate(data, accessFlags, usageFlags);
+	}
+
+	void deallocate(cv::UMatData* data) const override {
+		Lease* lease = (Lease*)data->userdata;
+		lease->stream->Queue(lease->index);
+		delete lease;
+		delete data;
+	}
+
+	// gray header over a driver buffer, holding it until released
+	cv::Mat Wrap(const std::shared_ptr<V4l2Stream>& stream, uint32_t index, cv::Size size, size_t stride) const {
+		cv::Mat mat(size, CV_8UC1, stream->buffers[index].start, stride);
+		cv::UMatData* data = new cv::UMatData(this);
+		data->data = data->origdata = mat.data;
+		data->size = stride * size.height;
+		data->userdata = new Lease { stream, index };
+		data->refcount = 1;
+		mat.u = data;
+		return mat;
+	}
+};
+
+static const CaptureBufferAllocator capture_allocator;
+
+class V4l2Camera : public Camera {
+public:
+
+	explicit V4l2Camera(FramePool& pool) : pool(pool), stream(std::make_shared<V4l2Stream>()) {}
+
+	~V4l2Camera() override {
+		if (record) {
+			fclose(record);
+		}
+	}
+
+	bool Open(const CameraSettings& settings) {
+		stream->fd = open(settings.device.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		if (stream->fd < 0) {
+			std::cout << "failed to open " << settings.device << ": " << strerror(errno) << "!" << std::endl;
+			return false;
+		}
+		int fd = stream->fd;
+
+		v4l2_capability capability {};
+		if (Ioctl(fd, VIDIOC_QUERYCAP, &capability) < 0) {
+			std::cout << settings.device << " is not a V4L2 device!" << std::endl;
+			return false;
+		}
+		uint32_t caps = (capability.capabilities & V4L2_CAP_DEVICE_CAPS) ? capability.device_caps : capability.capabilities;
+		if (!(caps & V4L2_CAP_VIDEO_CAPTURE) || !(caps & V4L2_CAP_STREAMING)) {
+			std::cout << settings.device << " has no single-planar streaming capture!" << std::endl;
+			return false;
+		}
+
+		if (!ChooseFormat(settings)) {
+			std::cout << settings.device << " offers no format with a luma plane!" << std::endl;
+			return false;
+		}
+
+		v4l2_requestbuffers request {};
+		request.count = settings.buffers;
+		request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		request.memory = V4L2_MEMORY_MMAP;
+		if (Ioctl(fd, VIDIOC_REQBUFS, &request) < 0 || request.count < 2) {
+			std::cout << "failed to get capture buffers from " << settings.device << "!" << std::endl;
+			return false;
+		}
+		stream->buffers.resize(request.count);
+		for (uint32_t i = 0; i < request.count; i++) {
+			v4l2_buffer buffer {};
+			buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+			buffer.memory = V4L2_MEMORY_MMAP;
+			buffer.index = i;
+			if (Ioctl(fd, VIDIOC_QUERYBUF, &buffer) < 0) {
+				return false;
+			}
+			stream->buffers[i].length = buffer.length;
+			stream->buffers[i].start = mmap(nullptr, buffer.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buffer.m.offset);
+			if (stream->buffers[i].start == MAP_FAILED || !stream->Queue(i)) {
+				std::cout << "failed to map capture buffer " << i << "!" << std::endl;
+				return false;
+			}
+		}
+
+		v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		if (Ioctl(fd, VIDIOC_STREAMON, &type) < 0) {
+			std::cout << "failed to start streaming from " << settings.device << ": " << strerror(errno) << "!" << std::endl;
+			return false;
+		}
+		stream->streaming = true;
+		device = settings.device;
+		jpegScale = settings.jpegScale;
+
+		if (settings.record.size()) {
+			if (format != V4L2_PIX_FMT_MJPEG) {
+				std::cout << "recording needs an MJPEG camera, " << settings.device << " streams " << FourccString(format) << "!" << std::endl;
+			}
+			else if (!(record = fopen(settings.record.c_str(), "wb"))) {
+				std::cout << "failed to open " << settings.record << ": " << strerror(errno) << "!" << std::endl;
+			}
+			else {
+				setvbuf(record, nullptr, _IOFBF, record_buffer_size);
+			}
+		}
+		return true;
+	}
+
+	bool Read(cv::Mat& image, Clock::time_point& captureTime) override {
+		v4l2_buffer buffer;
+		const uint8_t* data;
+		do {
+			buffer = {};
+			buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+			buffer.memory = V4L2_MEMORY_MMAP;
+			while (Ioctl(stream->fd, VIDIOC_DQBUF, &buffer) < 0) {
+				if (errno != EAGAIN) {
+					std::cout << "failed to dequeue a frame: " << strerror(errno) << "!" << std::endl;
+					return false;
+				}
+				pollfd ready { stream->fd, POLLIN, 0 };
+				if (poll(&ready, 1, capture_timeout_ms) <= 0) {
+					std::cout << "camera timed out, are all capture buffers held by the pipeline?" << std::endl;
+					return false;
+				}
+			}
+			data = (const uint8_t*)stream->buffers[buffer.index].start;
+			if (format == V4L2_PIX_FMT_MJPEG && !(buffer.flags & V4L2_BUF_FLAG_ERROR)) {
+				// a concatenation of JPEGs is a valid MJPEG stream (ffmpeg -f mjpeg)
+				if (record && fwrite(data, 1, buffer.bytesused, record) != buffer.bytesused) {
+					std::cout << "failed to record, stopping the recording!" << std::endl;
+					fclose(record);
+					record = nullptr;
+				}
+				if (!decoder.Decode(data, buffer.bytesused, jpegScale, pool, image)) {
+					buffer.flags |= V4L2_BUF_FLAG_ERROR;
+				}
+			}
+			// a frame the driver flagged as corrupt, or that failed to decode, goes straight back
+		} while ((buffer.flags & V4L2_BUF_FLAG_ERROR) && stream->Queue(buffer.index));
+
+		// steady_clock is CLOCK_MONOTONIC, so the kernel's timestamp can be used as is
+		if ((buffer.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+			captureTime = Clock::time_point(std::chrono::seconds(buffer.timestamp.tv_sec) + std::chrono::microseconds(buffer.timestamp.tv_usec));
+		}
+		else {
+			captureTime = Clock::now();
+		}
+
+		if (format == V4L2_PIX_FMT_MJPEG) {
+			stream->Queue(buffer.index);
+		}
+		else if (format == V4L2_PIX_FMT_YUYV) {
+			cv::Mat packed(size, CV_8UC2, (void*)data, stride);
+			image = pool.Acquire(size, CV_8UC1);
+			cv::extractChannel(packed, image, 0);
+			stream->Queue(buffer.index);
+		}
+		else {
+			image = capture_allocator.Wrap(stream, buffer.index, size, stride);
+		}
+		return true;
+	}
+
+	std::string Describe() const override {
+		std::string description = device + " " + FourccString(format) + " " + std::to_string(size.width) + "x" + std::to_string(size.height)
+			+ " (v4l2, " + std::to_string(stream->buffers.size()) + " buffers)";
+		if (format == V4L2_PIX_FMT_MJPEG) {
+			description += ", decoded to gray at 1/" + std::to_string(jpegScale) + (record ? ", recording" : "");
+		}
+		return description;
+	}
+
+private:
+
+	bool ChooseFormat(const CameraSettings& settings) {
+		std::vector<uint32_t> offered;
+		v4l2_fmtdesc description {};
+		description.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		while (Ioctl(stream->fd, VIDIOC_ENUM_FMT, &description) == 0) {
+			offered.push_back(description.pixelformat);
+			description.index++;
+		}
+		std::vector<uint32_t> candidates(std::begin(luma_formats), std::end(luma_formats));
+		if (settings.mjpeg || settings.record.size()) {
+			std::rotate(candidates.begin(), candidates.end() - 1, candidates.end());
+		}
+		for (uint32_t candidate : candidates) {
+			if (std::find(offered.begin(), offered.end(), candidate) == offered.end()) {
+				continue;
+			}
+			v4l2_format requested {};
+			requested.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+			requested.fmt.pix.width = settings.size.width;
+			requested.fmt.pix.height = settings.size.height;
+			requested.fmt.pix.pixelformat = candidate;
+			requested.fmt.pix.field = V4L2_FIELD_NONE;
+			if (Ioctl(stream->fd, VIDIOC_S_FMT, &requested) == 0 && requested.fmt.pix.pixelformat == candidate) {
+				format = candidate;
+				size = { (int)requested.fmt.pix.width, (int)requested.fmt.pix.height };
+				stride = requested.fmt.pix.bytesperline;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	FramePool& pool;
+	std::shared_ptr<V4l2Stream> stream;
+	std::string device;
+	uint32_t format = 0;
+	cv::Size size;
+	size_t stride = 0;
+	int jpegScale = 1;
+	JpegDecoder decoder;
+	FILE* record = nullptr;
+};
+
+class OpenCvCamera : public Camera {
+public:
+
+	explicit OpenCvCamera(FramePool& pool) : pool(pool) {}
+
+	bool Open(const CameraSettings& settings) {
+		device = settings.device;
+		return capture.open(settings.device);
+	}
+
+	// decodes into a pooled buffer once the frame format is known
+	bool Read(cv::Mat& image, Clock::time_point& captureTime) override {
+		if (!frameSize.empty()) {
+			image = pool.Acquire(frameSize, frameType);
+		}
+		const uchar* previousData = image.data;
+		capture >> image;
+		if (image.empty()) {
+			return false;
+		}
+		captureTime = Clock::now();
+		pool.Track(image, previousData);
+		frameSize = image.size();
+		frameType = image.type();
+		return true;
+	}
+
+	std::string Describe() const override {
+		return device + " " + std::to_string((int)capture.get(cv::CAP_PROP_FRAME_WIDTH)) + "x"
+			+ std::to_string((int)capture.get(cv::CAP_PROP_FRAME_HEIGHT)) + " (opencv)";
+	}
+
+private:
+
+	FramePool& pool;
+	cv::VideoCapture capture;
+	std::string device;
+	cv::Size frameSize;
+	int frameType = 0;
+};
+
+std::unique_ptr<Camera> CreateCamera(const CameraSettings& settings, FramePool& pool) {
+	if (settings.v4l2) {
+		std::unique_ptr<V4l2Camera> camera = std::make_unique<V4l2Camera>(pool);
+		if (camera->Open(settings)) {
+			return camera;
+		}
+		std::cout << "falling back to OpenCV capture" << std::endl;
+	}
+	std::unique_ptr<OpenCvCamera> camera = std::make_unique<OpenCvCamera>(pool);
+	if (!camera->Open(settings)) {
+		return nullptr;
+	}
+	return camera;
+}
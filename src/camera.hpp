@@ -0,0 +1,39 @@
+#pragma once
+
+#include "opencv2/core.hpp"
+#include "pipeline.hpp"
+#include "frame_pool.hpp"
+#include <memory>
+#include <string>
+
+struct CameraSettings {
+	std::string device = "/dev/video0";
+	cv::Size size { 640, 480 }; // requested from V4L2, the driver picks the nearest it supports
+	int buffers = 10; // driver buffers, has to cover every frame the pipeline holds at once plus one
+	bool v4l2 = true; // native V4L2 capture, false (or no usable format) for OpenCV's VideoCapture
+	bool mjpeg = false; // prefer MJPEG to raw formats, for resolutions a USB camera only streams compressed
+	int jpegScale = 1; // MJPEG frames are decoded to gray at 1/jpegScale, 1, 2, 4 or 8
+	std::string record; // MJPEG only, file the compressed frames are appended to as they arrive
+};
+
+// Frame source for the capture stage.
+class Camera {
+public:
+
+	virtual ~Camera() = default;
+
+	// waits for the next frame, image may be gray (the camera's luma) or BGR
+	// captureTime is when the frame was taken, as close as the backend can tell
+	virtual bool Read(cv::Mat& image, Clock::time_point& captureTime) = 0;
+
+	virtual std::string Describe() const = 0;
+};
+
+// Opens settings.device with native V4L2 capture if possible. For planar YUV and grey
+// formats the frame is a gray header over the mapped driver buffer, which goes back to
+// the driver once the last cv::Mat referencing it is released, and captureTime is the
+// kernel's timestamp. YUYV interleaves chroma, its luma is extracted into a pool buffer.
+// MJPEG, used when asked for or when nothing else is offered, is decoded to gray at a
+// reduced scale, and recording stores the compressed frames without re-encoding them.
+// Falls back to OpenCV's VideoCapture, which converts every frame to BGR.
+std::unique_ptr<Camera> CreateCamera(const CameraSettings& settings, FramePool& pool);
@@ -0,0 +1,409 @@
+#include "cascade.hpp"
+#include "opencv2/imgproc.hpp"
+#include "opencv2/objdetect.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <thread>
+
+namespace {
+
+	// CascadeClassifier lowers every stage threshold by this much when loading
+	constexpr float threshold_epsilon = 1e-5f;
+
+	// windows with a deviation this close to zero are flat and rejected outright
+	constexpr double min_variance_factor = 0.1;
+
+	// upright rectangle sum from the four corners of an integral image
+	template<typename T>
+	inline T RectSum(const T* origin, const int* corners) {
+		return origin[corners[0]] - origin[corners[1]] - origin[corners[2]] + origin[corners[3]];
+	}
+}
+
+// Boosted cascade as CascadeClassifier loads it: stages of weak classifiers, each a
+// tree of nodes over Haar or LBP features. Node children greater than zero are node
+// indices, others are negated leaf indices. Feature corners are element offsets into
+// the level integrals, recomputed whenever their row step changes.
+struct MultiCascadeDetector::Cascade {
+
+	struct Node {
+		int left, right;
+		int feature;
+		float threshold; // Haar, the node goes left if the normalized value is below it
+		int subset; // LBP, offset of the category bitmask, left if the pattern's bit is set
+	};
+
+	struct Weak {
+		int node, leaf;
+	};
+
+	struct Stage {
+		int weak, count;
+		float threshold;
+	};
+
+	struct HaarFeature {
+		cv::Rect rects[3];
+		float weights[3];
+		int corners[3][4];
+		bool tilted;
+	};
+
+	struct LbpFeature {
+		cv::Rect block; // one of the 3x3 blocks, in window coordinates
+		int corners[16]; // 4x4 grid of block corners
+	};
+
+	bool lbp = false;
+	bool tilted = false; // some Haar feature is rotated by 45 degrees
+	cv::Size window;
+	int subsetSize = 0;
+	std::vector<Stage> stages;
+	std::vector<Weak> weaks;
+	std::vector<Node> nodes;
+	std::vector<float> leaves;
+	std::vector<int> subsets;
+	std::vector<HaarFeature> haarFeatures;
+	std::vector<LbpFeature> lbpFeatures;
+	int normCorners[4]; // window minus a one pixel border, for the variance
+	double normArea = 0.0;
+	size_t step = 0;
+
+	bool Load(const std::string& model) {
+		cv::FileStorage storage(model, cv::FileStorage::READ);
+		if (!storage.isOpened()) {
+			return false;
+		}
+		cv::FileNode root = storage.getFirstTopLevelNode();
+		std::string featureType = root["featureType"].empty() ? "" : (std::string)root["featureType"];
+		if (featureType != "HAAR" && featureType != "LBP") {
+			std::cout << model << " is not a Haar or LBP cascade in the current format!" << std::endl;
+			return false;
+		}
+		lbp = featureType == "LBP";
+		window = { (int)root["width"], (int)root["height"] };
+		int maxCategories = (int)root["featureParams"]["maxCatCount"];
+		subsetSize = maxCategories > 0 ? (maxCategories + 31) / 32 : 0;
+		if (lbp != (subsetSize > 0)) {
+			return false;
+		}
+
+		for (const cv::FileNode& stageNode : root["stages"]) {
+			cv::FileNode weakNodes = stageNode["weakClassifiers"];
+			stages.push_back({ (int)weaks.size(), (int)weakNodes.size(), (float)stageNode["stageThreshold"] - threshold_epsilon });
+			for (const cv::FileNode& weakNode : weakNodes) {
+				weaks.push_back({ (int)nodes.size(), (int)leaves.size() });
+				cv::FileNode internal = weakNode["internalNodes"];
+				size_t values = subsetSize ? 3 + subsetSize : 4;
+				cv::FileNodeIterator it = internal.begin();
+				for (size_t i = 0; i < internal.size() / values; i++) {
+					Node node {};
+					it >> node.left >> node.right >> node.feature;
+					if (subsetSize) {
+						node.subset = (int)subsets.size();
+						for (int k = 0; k < subsetSize; k++) {
+							int bits;
+							it >> bits;
+							subsets.push_back(bits);
+						}
+					}
+					else {
+						it >> node.threshold;
+					}
+					nodes.push_back(node);
+				}
+				for (const cv::FileNode& leaf : weakNode["leafValues"]) {
+					leaves.push_back((float)leaf);
+				}
+			}
+		}
+
+		for (const cv::FileNode& featureNode : root["features"]) {
+			if (lbp) {
+				LbpFeature feature {};
+				cv::FileNodeIterator it = featureNode["rect"].begin();
+				it >> feature.block.x >> feature.block.y >> feature.block.width >> feature.block.height;
+				lbpFeatures.push_back(feature);
+				continue;
+			}
+			HaarFeature feature {};
+			int count = 0;
+			for (const cv::FileNode& rectNode : featureNode["rects"]) {
+				if (count == 3) {
+					return false;
+				}
+				cv::FileNodeIterator it = rectNode.begin();
+				it >> feature.rects[count].x >> feature.rects[count].y >> feature.rects[count].width >> feature.rects[count].height
+					>> feature.weights[count];
+				count++;
+			}
+			feature.tilted = (int)featureNode["tilted"] != 0;
+			tilted = tilted || feature.tilted;
+			haarFeatures.push_back(feature);
+		}
+
+		normArea = (double)(window.width - 2) * (window.height - 2);
+		return stages.size() && nodes.size();
+	}
+
+	// element offsets of every feature corner for integrals with the given row step
+	void SetStep(size_t newStep) {
+		if (newStep == step) {
+			return;
+		}
+		step = newStep;
+		int s = (int)step;
+		auto upright = [s](const cv::Rect& r, int* corners) {
+			corners[0] = r.x + s * r.y;
+			corners[1] = r.x + r.width + s * r.y;
+			corners[2] = r.x + s * (r.y + r.height);
+			corners[3] = r.x + r.width + s * (r.y + r.height);
+		};
+		// rotated rectangles go down and to the left from their top corner
+		auto rotated = [s](const cv::Rect& r, int* corners) {
+			corners[0] = r.x + s * r.y;
+			corners[1] = r.x - r.height + s * (r.y + r.height);
+			corners[2] = r.x + r.width + s * (r.y + r.width);
+			corners[3] = r.x + r.width - r.height + s * (r.y + r.width + r.height);
+		};
+		for (HaarFeature& feature : haarFeatures) {
+			for (int i = 0; i < 3; i++) {
+				if (feature.tilted) {
+					rotated(feature.rects[i], feature.corners[i]);
+				}
+				else {
+					upright(feature.rects[i], feature.corners[i]);
+				}
+			}
+		}
+		for (LbpFeature& feature : lbpFeatures) {
+			const cv::Rect& b = feature.block;
+			for (int row = 0; row < 4; row++) {
+				for (int column = 0; column < 4; column++) {
+					feature.corners[row * 4 + column] = b.x + column * b.width + s * (b.y + row * b.height);
+				}
+			}
+		}
+		upright({ 1, 1, window.width - 2, window.height - 2 }, normCorners);
+	}
+
+	// 8 bit local binary pattern of the 3x3 blocks around the center one, clockwise from top left
+	static int Pattern(const int* sum, const int* c) {
+		int center = sum[c[5]] - sum[c[6]] - sum[c[9]] + sum[c[10]];
+		return (sum[c[0]] - sum[c[1]] - sum[c[4]] + sum[c[5]] >= center ? 128 : 0) |
+			(sum[c[1]] - sum[c[2]] - sum[c[5]] + sum[c[6]] >= center ? 64 : 0) |
+			(sum[c[2]] - sum[c[3]] - sum[c[6]] + sum[c[7]] >= center ? 32 : 0) |
+			(sum[c[6]] - sum[c[7]] - sum[c[10]] + sum[c[11]] >= center ? 16 : 0) |
+			(sum[c[10]] - sum[c[11]] - sum[c[14]] + sum[c[15]] >= center ? 8 : 0) |
+			(sum[c[9]] - sum[c[10]] - sum[c[13]] + sum[c[14]] >= center ? 4 : 0) |
+			(sum[c[8]] - sum[c[9]] - sum[c[12]] + sum[c[13]] >= center ? 2 : 0) |
+			(sum[c[4]] - sum[c[5]] - sum[c[8]] + sum[c[9]] >= center ? 1 : 0);
+	}
+
+	// evaluates the window whose top left corner is offset elements into the integrals
+	// returns 1 if every stage passed, otherwise minus the stage that rejected it
+	// (0 for the first, which lets the scan skip the next position) or -1 for a flat window
+	int Run(const Level& level, size_t offset) const {
+		const int* sum = level.sum.ptr<int>() + offset;
+		const int* tiltedSum = tilted ? level.tilted.ptr<int>() + offset : nullptr;
+		float varianceFactor = 1.0f;
+		if (!lbp) {
+			const double* sqsum = level.sqsum.ptr<double>() + offset;
+			int windowSum = RectSum(sum, normCorners);
+			double deviation = normArea * RectSum(sqsum, normCorners) - (double)windowSum * windowSum;
+			if (deviation <= 0.0) {
+				return -1;
+			}
+			varianceFactor = (float)(1.0 / std::sqrt(deviation));
+			if (normArea * varianceFactor >= min_variance_factor) {
+				return -1;
+			}
+		}
+
+		for (size_t si = 0; si < stages.size(); si++) {
+			const Stage& stage = stages[si];
+			double stageSum = 0.0;
+			for (int wi = stage.weak; wi < stage.weak + stage.count; wi++) {
+				const Weak& weak = weaks[wi];
+				int index = 0;
+				for (;;) {
+					const Node& node = nodes[weak.node + index];
+					bool left;
+					if (lbp) {
+						int pattern = Pattern(sum, lbpFeatures[node.feature].corners);
+						left = subsets[node.subset + (pattern >> 5)] & (1 << (pattern & 31));
+					}
+					else {
+						const HaarFeature& feature = haarFeatures[node.feature];
+						const int* origin = feature.tilted ? tiltedSum : sum;
+						float value = feature.weights[0] * RectSum(origin, feature.corners[0]) +
+							feature.weights[1] * RectSum(origin, feature.corners[1]);
+						if (feature.weights[2] != 0.0f) {
+							value += feature.weights[2] * RectSum(origin, feature.corners[2]);
+						}
+						left = value * varianceFactor < node.threshold;
+					}
+					index = left ? node.left : node.right;
+					if (index <= 0) {
+						break;
+					}
+				}
+				stageSum += leaves[weak.leaf - index];
+			}
+			if (stageSum < stage.threshold) {
+				return -(int)si;
+			}
+		}
+		return 1;
+	}
+};
+
+MultiCascadeDetector::MultiCascadeDetector(const DetectorSettings& settings)
+	: pool(settings.threads ? settings.threads : std::max(std::thread::hardware_concurrency(), 1u), settings.cpus),
+	candidates(pool.Size()), openCvThreads(cv::getNumThreads()) {
+	// the workers already use every core, OpenCV's own threads would only oversubscribe them
+	cv::setNumThreads(1);
+}
+
+// detectors created afterwards, like the CascadeClassifier fallback, get OpenCV's threads back
+MultiCascadeDetector::~MultiCascadeDetector() {
+	cv::setNumThreads(openCvThreads);
+}
+
+bool MultiCascadeDetector::Add(const std::string& model) {
+	if (cascades.size() == 64) {
+		std::cout << "at most 64 cascades can run together!" << std::endl;
+		return false;
+	}
+	std::unique_ptr<Cascade> cascade = std::make_unique<Cascade>();
+	if (!cascade->Load(model)) {
+		return false;
+	}
+	cascades.push_back(std::move(cascade));
+	results.resize(cascades.size());
+	return true;
+}
+
+void MultiCascadeDetector::Detect(const cv::Mat& image, std::vector<cv::Rect>& objects, cv::Size minSize, cv::Size maxSize) {
+	if (maxSize.empty()) {
+		maxSize = image.size();
+	}
+
+	// the union of the levels every cascade would pick on its own
+	levelCount = 0;
+	bool needSqsum = false, needTilted = false;
+	for (double factor = 1.0; ; factor *= scale_factor) {
+		cv::Size size(cvRound(image.cols / factor), cvRound(image.rows / factor));
+		uint64_t used = 0;
+		bool larger = false;
+		for (size_t i = 0; i < cascades.size(); i++) {
+			const Cascade& cascade = *cascades[i];
+			cv::Size windowSize(cvRound(cascade.window.width * factor), cvRound(cascade.window.height * factor));
+			if (size.width <= cascade.window.width || size.height <= cascade.window.height ||
+				windowSize.width > maxSize.width || windowSize.height > maxSize.height) {
+				continue;
+			}
+			larger = true;
+			if (windowSize.width >= minSize.width && windowSize.height >= minSize.height) {
+				used |= 1ull << i;
+				needSqsum = needSqsum || !cascade.lbp;
+				needTilted = needTilted || cascade.tilted;
+			}
+		}
+		if (!larger) {
+			break;
+		}
+		if (used) {
+			if (levels.size() == levelCount) {
+				levels.emplace_back();
+			}
+			Level& level = levels[levelCount++];
+			level.factor = factor;
+			level.size = size;
+			level.cascades = used;
+		}
+	}
+
+	// every integral uses the row step of the full size one
+	int stepColumns = image.cols + 1;
+	pool.Run(levelCount, [&](size_t index, size_t) {
+		Level& level = levels[index];
+		const cv::Mat* source = &image;
+		if (level.size != image.size()) {
+			cv::resize(image, level.image, level.size, 0, 0, cv::INTER_LINEAR);
+			source = &level.image;
+		}
+		int rows = level.size.height + 1;
+		cv::Rect used(0, 0, level.size.width + 1, rows);
+		level.sumBuffer.create(rows, stepColumns, CV_32S);
+		level.sum = level.sumBuffer(used);
+		if (!needSqsum) {
+			cv::integral(*source, level.sum, CV_32S);
+			return;
+		}
+		level.sqsumBuffer.create(rows, stepColumns, CV_64F);
+		level.sqsum = level.sqsumBuffer(used);
+		if (!needTilted) {
+			cv::integral(*source, level.sum, level.sqsum, CV_32S, CV_64F);
+			return;
+		}
+		level.tiltedBuffer.create(rows, stepColumns, CV_32S);
+		level.tilted = level.tiltedBuffer(used);
+		cv::integral(*source, level.sum, level.sqsum, level.tilted, CV_32S, CV_64F);
+	});
+
+	stripes.clear();
+	for (size_t index = 0; index < levelCount; index++) {
+		const Level& level = levels[index];
+		for (size_t i = 0; i < cascades.size(); i++) {
+			if (!(level.cascades & (1ull << i))) {
+				continue;
+			}
+			cascades[i]->SetStep(stepColumns);
+			int starts = level.size.height - cascades[i]->window.height;
+			for (int y = 0; y < starts; y += stripe_rows) {
+				stripes.push_back({ index, i, y, std::min(y + stripe_rows, starts) });
+			}
+		}
+	}
+
+	for (std::vector<Candidate>& workerCandidates : candidates) {
+		workerCandidates.clear();
+	}
+	pool.Run(stripes.size(), [&](size_t task, size_t worker) {
+		const Stripe& stripe = stripes[task];
+		const Level& level = levels[stripe.level];
+		const Cascade& cascade = *cascades[stripe.cascade];
+		cv::Size windowSize(cvRound(cascade.window.width * level.factor), cvRound(cascade.window.height * level.factor));
+		int columns = level.size.width - cascade.window.width;
+		int step = level.factor > 2.0 ? 1 : 2;
+		for (int y = stripe.begin; y < stripe.end; y += step) {
+			for (int x = 0; x < columns; x += step) {
+				int result = cascade.Run(level, (size_t)y * stepColumns + x);
+				if (result > 0) {
+					candidates[worker].push_back({ stripe.cascade,
+						{ cvRound(x * level.factor), cvRound(y * level.factor), windowSize.width, windowSize.height } });
+				}
+				else if (result == 0) {
+					// rejected by the first stage, the neighbour most likely is too
+					x += step;
+				}
+			}
+		}
+	});
+
+	for (std::vector<cv::Rect>& cascadeResults : results) {
+		cascadeResults.clear();
+	}
+	for (const std::vector<Candidate>& workerCandidates : candidates) {
+		for (const Candidate& candidate : workerCandidates) {
+			results[candidate.cascade].push_back(candidate.rect);
+		}
+	}
+	objects.clear();
+	for (std::vector<cv::Rect>& cascadeResults : results) {
+		cv::groupRectangles(cascadeResults, min_neighbors, 0.2);
+		objects.insert(objects.end(), cascadeResults.begin(), cascadeResults.end());
+	}
+}
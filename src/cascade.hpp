@@ -0,0 +1,72 @@
+#pragma once
+
+#include "opencv2/core.hpp"
+#include "detector.hpp"
+#include "thread_pool.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+// Runs several Haar and LBP cascades (OpenCV's XML format) on the same frame. Each
+// detectMultiScale call builds its own scale pyramid and integral images, here the
+// pyramid levels, their sum, squared sum and tilted integrals are built once per frame
+// for every cascade that needs them, so another model only costs its own evaluation.
+// Levels are one task each, then every (level, cascade) pair is cut into stripes of
+// window rows that run on the work-stealing pool. Windows are scanned and grouped like
+// detectMultiScale with CASCADE_SCALE_IMAGE does.
+class MultiCascadeDetector : public ObjectDetector {
+public:
+
+	static constexpr double scale_factor = 1.1;
+	static constexpr int min_neighbors = 2;
+	static constexpr int stripe_rows = 16; // window start rows per task, even to keep the 2px step grid
+
+	explicit MultiCascadeDetector(const DetectorSettings& settings);
+	~MultiCascadeDetector() override;
+
+	// registers a cascade, false if the file is missing or in the old pre-2.4 format
+	bool Add(const std::string& model);
+
+	size_t Count() const {
+		return cascades.size();
+	}
+
+	// objects are the grouped detections of all cascades together
+	void Detect(const cv::Mat& image, std::vector<cv::Rect>& objects, cv::Size minSize, cv::Size maxSize) override;
+
+	// detections of one cascade from the last Detect, in the order they were added
+	const std::vector<cv::Rect>& Objects(size_t cascade) const {
+		return results[cascade];
+	}
+
+private:
+
+	struct Cascade;
+
+	// one pyramid level, the integrals share a row step so feature offsets are per frame
+	struct Level {
+		double factor;
+		cv::Size size;
+		uint64_t cascades; // bit i set if cascade i is evaluated at this level
+		cv::Mat image, sumBuffer, sqsumBuffer, tiltedBuffer, sum, sqsum, tilted;
+	};
+
+	struct Stripe {
+		size_t level, cascade;
+		int begin, end; // window start rows
+	};
+
+	struct Candidate {
+		size_t cascade;
+		cv::Rect rect;
+	};
+
+	WorkStealingPool pool;
+	std::vector<std::unique_ptr<Cascade>> cascades;
+	std::vector<Level> levels;
+	size_t levelCount = 0;
+	std::vector<Stripe> stripes;
+	std::vector<std::vector<Candidate>> candidates; // per worker
+	std::vector<std::vector<cv::Rect>> results; // per cascade
+	int openCvThreads; // restored on destruction, the constructor turns OpenCV's threading off
+};
@@ -0,0 +1,126 @@
+#include "detection.hpp"
+#include "preprocess.hpp"
+#include "opencv2/imgproc.hpp"
+
+Target FindTarget(const cv::Mat& frame, ObjectDetector& detector, TargetTracker& tracker, MotionGate* motion, const DetectResolution& resolution, FramePool& pool,
+	std::vector<cv::Rect>& faces, DetectTimings* timings) {
+
+	Target target { INT32_MAX, INT32_MAX };
+	cv::Point frameCenter = { frame.cols / 2, frame.rows / 2 };
+
+	// the gate only runs while searching, a locked target is followed on every frame
+	Clock::time_point gateStart = Clock::now();
+	MotionGate::Decision decision = MotionGate::Decision::Full;
+	if (motion && tracker.Locked()) {
+		motion->Reset();
+	}
+	else if (motion) {
+		decision = motion->Update(frame);
+	}
+	Clock::duration gateTime = Clock::now() - gateStart;
+	if (decision == MotionGate::Decision::Skip) {
+		faces.clear();
+		if (timings) {
+			*timings = { gateTime, {}, {}, {}, {}, 0 };
+		}
+		return target;
+	}
+
+	double scale = resolution.scale;
+	double fx = 1 / scale;
+	bool color = detector.Color();
+	bool gray = frame.channels() == 1;
+	PooledMat smallFrame(pool, { cvRound(frame.cols * fx), cvRound(frame.rows * fx) }, color ? CV_8UC3 : CV_8UC1);
+	const uchar* smallData = smallFrame.mat.data;
+	size_t facesCapacity = faces.capacity();
+
+	Clock::time_point start = Clock::now(), converted = start, resized, equalized;
+	if (color && gray) {
+		PooledMat smallGray(pool, smallFrame.mat.size(), CV_8UC1);
+		cv::resize(frame, smallGray.mat, smallGray.mat.size(), 0, 0, cv::INTER_LINEAR);
+		cv::cvtColor(smallGray.mat, smallFrame.mat, cv::COLOR_GRAY2BGR);
+		resized = equalized = Clock::now();
+	}
+	else if (color) {
+		cv::resize(frame, smallFrame.mat, smallFrame.mat.size(), 0, 0, cv::INTER_LINEAR);
+		resized = equalized = Clock::now();
+	}
+	else if (resolution.fused) {
+		// one thread_local kernel per detect thread, its tables are rebuilt when the scale changes
+		static thread_local GrayPreprocessor preprocessor;
+		preprocessor.Downscale(frame, smallFrame.mat);
+		resized = Clock::now();
+		preprocessor.Equalize(smallFrame.mat);
+		equalized = Clock::now();
+	}
+	else if (gray) {
+		// luma straight from the camera, there is nothing to convert
+		cv::resize(frame, smallFrame.mat, smallFrame.mat.size(), 0, 0, cv::INTER_LINEAR);
+		resized = Clock::now();
+		cv::equalizeHist(smallFrame.mat, smallFrame.mat);
+		equalized = Clock::now();
+	}
+	else {
+		PooledMat grayFrame(pool, frame.size(), CV_8UC1);
+		const uchar* grayData = grayFrame.mat.data;
+		cv::cvtColor(frame, grayFrame.mat, cv::COLOR_BGR2GRAY);
+		converted = Clock::now();
+		cv::resize(grayFrame.mat, smallFrame.mat, smallFrame.mat.size(), 0, 0, cv::INTER_LINEAR);
+		resized = Clock::now();
+		cv::equalizeHist(smallFrame.mat, smallFrame.mat);
+		equalized = Clock::now();
+		pool.Track(grayFrame.mat, grayData);
+	}
+
+	tracker.SetScale(scale);
+	if (decision == MotionGate::Decision::Regions) {
+		tracker.DetectRegions(detector, smallFrame.mat, faces, resolution.minSize, motion->Regions());
+	}
+	else {
+		tracker.Detect(detector, smallFrame.mat, faces, resolution.minSize);
+	}
+
+	if (timings) {
+		timings->motion = gateTime;
+		timings->cvtColor = converted - start;
+		timings->resize = resized - converted;
+		timings->equalizeHist = equalized - resized;
+		timings->detect = Clock::now() - equalized;
+		timings->detections = faces.size();
+	}
+
+	pool.Track(smallFrame.mat, smallData);
+	pool.Track(faces, facesCapacity);
+
+	if (!faces.size()) {
+		tracker.Unlock();
+		return target;
+	}
+
+	//std::cout << "detecting faces" << std::endl;
+
+	int32_t closestSqrMag = INT32_MAX;
+	cv::Rect closestFace;
+
+	for (cv::Rect& face : faces) {
+
+		cv::Point faceCenter;
+		faceCenter.x = cvRound((face.x + face.width * 0.5) * scale);
+		faceCenter.y = cvRound((face.y + face.height * 0.5) * scale);
+
+		Target newTarget = { frameCenter.x - faceCenter.x, frameCenter.y - faceCenter.y };
+		int32_t sqrMag = newTarget.x * newTarget.x + newTarget.y * newTarget.y;
+
+		if (sqrMag < closestSqrMag) {
+			closestSqrMag = sqrMag;
+			closestFace = face;
+			target = newTarget;
+		}
+	}
+
+	tracker.Lock(smallFrame.mat, closestFace);
+
+	target.y = frame.rows / 2 - (frame.rows - (frameCenter.y - target.y));
+
+	return target;
+}
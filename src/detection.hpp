@@ -0,0 +1,40 @@
+#pragma once
+
+#include "opencv2/core.hpp"
+#include "pipeline.hpp"
+#include "target.hpp"
+#include "frame_pool.hpp"
+#include "tracker.hpp"
+#include "detector.hpp"
+#include "motion.hpp"
+#include <vector>
+
+// How far the frame is downscaled before detection and the smallest face a full scan
+// looks for, in downscaled pixels.
+struct DetectResolution {
+	double scale = 1.0;
+	cv::Size minSize { 30, 30 };
+	bool fused = true; // gray detectors get the frame from the fused SIMD kernel instead of cvtColor, resize and equalizeHist
+};
+
+// Time spent in each step of the last FindTarget call. The fused kernel converts while
+// it downscales, its whole first pass counts as resize. A frame the motion gate skips
+// only has motion set.
+struct DetectTimings {
+	Clock::duration motion, cvtColor, resize, equalizeHist, detect;
+	size_t detections;
+};
+
+// Finds the face closest to the frame center and returns its offset. frame is BGR or,
+// straight from a luma capture, gray. The detector gets
+// the downscaled frame, equalized gray unless it asks for color. faces holds the
+// detections in downscaled coordinates afterwards, it is kept by the caller so it is
+// not reallocated every call. Nothing is drawn, annotation is up to the preview sink.
+// The fused kernel downscales like OpenCV's bit-exact bilinear filter (INTER_LINEAR_EXACT),
+// the OpenCV fallback keeps INTER_LINEAR. Their downscaled pixels differ by at most one
+// level before equalization, equalizeHist's table can spread that much further apart.
+// test/preprocess_test checks the kernel is exact against INTER_LINEAR_EXACT, not the fallback.
+// With a motion gate, frames are only scanned where they changed while nothing is
+// locked, and a static scene returns no target without running the detector.
+Target FindTarget(const cv::Mat& frame, ObjectDetector& detector, TargetTracker& tracker, MotionGate* motion, const DetectResolution& resolution, FramePool& pool,
+	std::vector<cv::Rect>& faces, DetectTimings* timings = nullptr);
@@ -0,0 +1,140 @@
+#include "detector.hpp"
+#include "cascade.hpp"
+#include "opencv2/objdetect.hpp"
+#include "opencv2/imgproc.hpp"
+#include <iostream>
+
+constexpr const char* haar_model = "opencv/data/haarcascades/haarcascade_frontalface_default.xml";
+constexpr const char* lbp_model = "opencv/data/lbpcascades/lbpcascade_frontalface_improved.xml";
+// frontal and profile faces plus upper bodies, comma separated like --model takes them
+constexpr const char* multi_models = "opencv/data/haarcascades/haarcascade_frontalface_default.xml,"
+	"opencv/data/haarcascades/haarcascade_profileface.xml,opencv/data/haarcascades/haarcascade_upperbody.xml";
+// not shipped, download face_detection_yunet_2023mar.onnx from the opencv_zoo repository
+constexpr const char* dnn_model = "opencv/data/dnn/face_detection_yunet_2023mar.onnx";
+
+// Haar and LBP cascades, any cascade file in opencv/data works (profile, full body, ...)
+class CascadeDetector : public ObjectDetector {
+public:
+
+	bool Load(const std::string& model) {
+		return cascade.load(model);
+	}
+
+	void Detect(const cv::Mat& image, std::vector<cv::Rect>& objects, cv::Size minSize, cv::Size maxSize) override {
+		cascade.detectMultiScale(image, objects, 1.1, 2, cv::CASCADE_SCALE_IMAGE, minSize, maxSize);
+	}
+
+private:
+
+	cv::CascadeClassifier cascade;
+};
+
+// HOG + linear SVM people detector. Cascades with HOG features like hogcascade_pedestrians.xml
+// are no longer supported by CascadeClassifier, so this uses HOGDescriptor's built in model.
+class HogDetector : public ObjectDetector {
+public:
+
+	HogDetector() {
+		hog.setSVMDetector(cv::HOGDescriptor::getDefaultPeopleDetector());
+	}
+
+	void Detect(const cv::Mat& image, std::vector<cv::Rect>& objects, cv::Size minSize, cv::Size maxSize) override {
+		objects.clear();
+		if (image.cols < hog.winSize.width || image.rows < hog.winSize.height) {
+			return;
+		}
+		hog.detectMultiScale(image, objects, 0, cv::Size(8, 8), cv::Size(), 1.05, 2.0);
+		std::erase_if(objects, [&](const cv::Rect& object) {
+			return object.width < minSize.width || object.height < minSize.height ||
+				(!maxSize.empty() && (object.width > maxSize.width || object.height > maxSize.height));
+		});
+	}
+
+private:
+
+	cv::HOGDescriptor hog;
+};
+
+// YuNet face detector running on the OpenCV DNN CPU backend
+class DnnDetector : public ObjectDetector {
+public:
+
+	bool Load(const std::string& model) {
+		try {
+			detector = cv::FaceDetectorYN::create(model, "", cv::Size(320, 320));
+		}
+		catch (const cv::Exception& e) {
+			std::cout << e.what() << std::endl;
+			return false;
+		}
+		return !detector.empty();
+	}
+
+	bool Color() const override {
+		return true;
+	}
+
+	void Detect(const cv::Mat& image, std::vector<cv::Rect>& objects, cv::Size minSize, cv::Size maxSize) override {
+		objects.clear();
+		if (detector->getInputSize() != image.size()) {
+			detector->setInputSize(image.size());
+		}
+		detector->detect(image, results);
+		for (int i = 0; i < results.rows; i++) {
+			const float* face = results.ptr<float>(i);
+			cv::Rect object(cvRound(face[0]), cvRound(face[1]), cvRound(face[2]), cvRound(face[3]));
+			if (object.width >= minSize.width && object.height >= minSize.height &&
+				(maxSize.empty() || (object.width <= maxSize.width && object.height <= maxSize.height))) {
+				objects.push_back(object);
+			}
+		}
+	}
+
+private:
+
+	cv::Ptr<cv::FaceDetectorYN> detector;
+	cv::Mat results;
+};
+
+std::unique_ptr<ObjectDetector> CreateDetector(const std::string& engine, const std::string& model, const DetectorSettings& settings) {
+	// with threads the native evaluator runs the single cascade on the pool, old format
+	// cascades it cannot read still work on CascadeClassifier's own threads
+	if ((engine == "haar" || engine == "lbp") && settings.threads) {
+		std::unique_ptr<MultiCascadeDetector> detector = std::make_unique<MultiCascadeDetector>(settings);
+		if (detector->Add(model.size() ? model : engine == "haar" ? haar_model : lbp_model)) {
+			return detector;
+		}
+		std::cout << "falling back to CascadeClassifier, --detect-threads is ignored" << std::endl;
+	}
+	if (engine == "haar" || engine == "lbp") {
+		std::unique_ptr<CascadeDetector> detector = std::make_unique<CascadeDetector>();
+		if (!detector->Load(model.size() ? model : engine == "haar" ? haar_model : lbp_model)) {
+			return nullptr;
+		}
+		return detector;
+	}
+	if (engine == "multi") {
+		std::unique_ptr<MultiCascadeDetector> detector = std::make_unique<MultiCascadeDetector>(settings);
+		std::string models = model.size() ? model : multi_models;
+		size_t begin = 0;
+		while (begin <= models.size()) {
+			size_t end = std::min(models.find(',', begin), models.size());
+			if (!detector->Add(models.substr(begin, end - begin))) {
+				return nullptr;
+			}
+			begin = end + 1;
+		}
+		return detector;
+	}
+	if (engine == "hog") {
+		return std::make_unique<HogDetector>();
+	}
+	if (engine == "dnn") {
+		std::unique_ptr<DnnDetector> detector = std::make_unique<DnnDetector>();
+		if (!detector->Load(model.size() ? model : dnn_model)) {
+			return nullptr;
+		}
+		return detector;
+	}
+	return nullptr;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "opencv2/core.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+// Object detection engine FindTarget and the tracker run on the downscaled frame.
+class ObjectDetector {
+public:
+
+	virtual ~ObjectDetector() = default;
+
+	// true if the engine wants the BGR frame, otherwise it gets the equalized gray one
+	virtual bool Color() const {
+		return false;
+	}
+
+	// finds objects between minSize and maxSize (empty for unbounded) in image coordinates
+	virtual void Detect(const cv::Mat& image, std::vector<cv::Rect>& objects, cv::Size minSize, cv::Size maxSize) = 0;
+};
+
+struct DetectorSettings {
+	size_t threads = 0; // cascade engines only, 0 leaves parallelism to OpenCV (multi: one worker per core)
+	std::vector<int> cpus; // cores the detection workers are pinned to, empty for no pinning
+};
+
+// engine names accepted by CreateDetector, model files are looked up relative to the working directory
+constexpr const char* detector_engines[] = { "haar", "lbp", "hog", "dnn", "multi" };
+
+// creates the named engine, loading model or the engine's default model when it is empty
+// multi takes a comma separated list of cascades and runs them all on a shared pyramid
+// returns nullptr if the engine is unknown or its model could not be loaded
+std::unique_ptr<ObjectDetector> CreateDetector(const std::string& engine, const std::string& model = "",
+	const DetectorSettings& settings = {});
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "opencv2/core.hpp"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Pool of preallocated frame buffers keyed by size and type. Buffers are borrowed by
+// the capture and detection stages and handed back once the frame has been consumed,
+// so after warm-up no frame buffer is allocated at all; allocations counts every
+// buffer that had to be created, which should stop growing in the steady state.
+class FramePool {
+public:
+
+	explicit FramePool(size_t capacity) : capacity(capacity) {
+		buffers.reserve(capacity);
+	}
+
+	cv::Mat Acquire(cv::Size size, int type) {
+		{
+			std::lock_guard lock(mutex);
+			for (size_t i = 0; i < buffers.size(); i++) {
+				if (buffers[i].size() == size && buffers[i].type() == type) {
+					cv::Mat mat = std::move(buffers[i]);
+					buffers[i] = std::move(buffers.back());
+					buffers.pop_back();
+					return mat;
+				}
+			}
+		}
+		allocations.fetch_add(1, std::memory_order_relaxed);
+		return cv::Mat(size, type);
+	}
+
+	// matrices over memory the pool did not allocate, such as mapped capture buffers,
+	// are only released so their owner gets the memory back, as are buffers another
+	// header still shares (a preview copy, a ROI) so they are not handed out in use
+	void Release(cv::Mat& mat) {
+		if (mat.empty()) {
+			return;
+		}
+		if (!mat.u || mat.u->currAllocator != cv::Mat::getDefaultAllocator() ||
+			mat.u->refcount != 1 || mat.isSubmatrix()) {
+			mat.release();
+			return;
+		}
+		std::lock_guard lock(mutex);
+		if (buffers.size() < capacity) {
+			buffers.push_back(std::move(mat));
+		}
+		mat.release();
+	}
+
+	// counts a buffer OpenCV had to (re)allocate while writing into a borrowed one
+	void Track(const cv::Mat& mat, const uchar* previousData) {
+		if (mat.data != previousData) {
+			allocations.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	template<typename T>
+	void Track(const std::vector<T>& vector, size_t previousCapacity) {
+		if (vector.capacity() != previousCapacity) {
+			allocations.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	uint64_t Allocations() const {
+		return allocations.load(std::memory_order_relaxed);
+	}
+
+	size_t Available() {
+		std::lock_guard lock(mutex);
+		return buffers.size();
+	}
+
+private:
+
+	const size_t capacity;
+	std::mutex mutex;
+	std::vector<cv::Mat> buffers;
+	std::atomic<uint64_t> allocations { 0 };
+};
+
+// Scoped borrow for buffers that never leave the calling stage.
+struct PooledMat {
+
+	PooledMat(FramePool& pool, cv::Size size, int type) : pool(pool), mat(pool.Acquire(size, type)) {}
+
+	~PooledMat() {
+		pool.Release(mat);
+	}
+
+	PooledMat(const PooledMat&) = delete;
+	PooledMat& operator=(const PooledMat&) = delete;
+
+	FramePool& pool;
+	cv::Mat mat;
+};
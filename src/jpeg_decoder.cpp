@@ -0,0 +1,71 @@
+#include "jpeg_decoder.hpp"
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <iostream>
+#include <jpeglib.h>
+
+struct JpegState {
+	jpeg_decompress_struct decompress;
+	jpeg_error_mgr errors;
+	jmp_buf failed;
+};
+
+// the default handler exits the process, a corrupt frame is only dropped
+static void OnJpegError(j_common_ptr common) {
+	char message[JMSG_LENGTH_MAX];
+	common->err->format_message(common, message);
+	std::cout << "failed to decode a jpeg frame: " << message << "!" << std::endl;
+	longjmp(((JpegState*)common->client_data)->failed, 1);
+}
+
+// corrupt data warnings are frequent on USB cameras and not worth a line per frame
+static void OnJpegMessage(j_common_ptr) {}
+
+JpegDecoder::JpegDecoder() : state(std::make_unique<JpegState>()) {
+	state->decompress.err = jpeg_std_error(&state->errors);
+	state->errors.error_exit = OnJpegError;
+	state->errors.output_message = OnJpegMessage;
+	jpeg_create_decompress(&state->decompress);
+	state->decompress.client_data = state.get();
+}
+
+JpegDecoder::~JpegDecoder() {
+	jpeg_destroy_decompress(&state->decompress);
+}
+
+bool JpegDecoder::Decode(const uint8_t* data, size_t size, int scale, FramePool& pool, cv::Mat& image) {
+	jpeg_decompress_struct& decompress = state->decompress;
+	// nothing with a destructor may be created between setjmp and the last libjpeg call
+	if (setjmp(state->failed)) {
+		jpeg_abort_decompress(&decompress);
+		return false;
+	}
+
+	jpeg_mem_src(&decompress, data, (unsigned long)size);
+	jpeg_read_header(&decompress, TRUE);
+	decompress.out_color_space = JCS_GRAYSCALE;
+	decompress.scale_num = 1;
+	decompress.scale_denom = scale;
+	decompress.dct_method = JDCT_IFAST;
+	decompress.do_fancy_upsampling = FALSE;
+	jpeg_calc_output_dimensions(&decompress);
+
+	cv::Size outputSize((int)decompress.output_width, (int)decompress.output_height);
+	if (image.size() != outputSize || image.type() != CV_8UC1) {
+		pool.Release(image);
+		image = pool.Acquire(outputSize, CV_8UC1);
+	}
+
+	jpeg_start_decompress(&decompress);
+	while (decompress.output_scanline < decompress.output_height) {
+		JSAMPROW rows[4];
+		int count = std::min<int>(4, decompress.output_height - decompress.output_scanline);
+		for (int i = 0; i < count; i++) {
+			rows[i] = image.ptr(decompress.output_scanline + i);
+		}
+		jpeg_read_scanlines(&decompress, rows, count);
+	}
+	jpeg_finish_decompress(&decompress);
+	return true;
+}
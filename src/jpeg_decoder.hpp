@@ -0,0 +1,30 @@
+#pragma once
+
+#include "opencv2/core.hpp"
+#include "frame_pool.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+struct JpegState;
+
+// Decodes JPEG frames straight to gray at 1/scale of the coded size with libjpeg-turbo's
+// DCT scaling: the inverse DCT only produces the reduced image and the chroma planes are
+// never reconstructed, so a 1/4 scale decode costs a fraction of a full color one.
+// Missing Huffman tables, common in MJPEG from USB cameras, fall back to the standard ones.
+class JpegDecoder {
+public:
+
+	JpegDecoder();
+	~JpegDecoder();
+
+	JpegDecoder(const JpegDecoder&) = delete;
+	JpegDecoder& operator=(const JpegDecoder&) = delete;
+
+	// scale is 1, 2, 4 or 8, image is taken from pool
+	bool Decode(const uint8_t* data, size_t size, int scale, FramePool& pool, cv::Mat& image);
+
+private:
+
+	std::unique_ptr<JpegState> state;
+};
@@ -1,17 +1,34 @@
 #include "wiringPi.h"
-#include "softPwm.h"
-#include "opencv2/highgui.hpp"
-#include "opencv2/imgproc.hpp"
-#include "opencv2/objdetect.hpp"
+#include "pipeline.hpp"
+#include "camera.hpp"
+#include "target.hpp"
+#include "frame_pool.hpp"
+#include "tracker.hpp"
+#include "detector.hpp"
+#include "thread_pool.hpp"
+#include "detection.hpp"
+#include "motion.hpp"
+#include "resolution.hpp"
+#include "predictor.hpp"
+#include "motor_control.hpp"
+#include "motor_output.hpp"
+#include "preview.hpp"
+#include "realtime.hpp"
+#include <algorithm>
+#include <csignal>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
 #include <opencv2/core/types.hpp>
 #include <time.h>
 #include <math.h>
 #include <vector>
+#include <thread>
 #include <iostream>
 
-constexpr const char* window_name = "Camera View";
-
 constexpr int x_motor_pwm = 3;
 constexpr int x_motor_0 = 4;
 constexpr int x_motor_1 = 5;
@@ -19,155 +36,329 @@ constexpr int y_motor_pwm = 0;
 constexpr int y_motor_0 = 1;
 constexpr int y_motor_1 = 2;
 
-struct Target {
-	int x, y; // relative to frame center
-};
-
-static inline Target FindTarget(cv::Mat& frame, cv::CascadeClassifier& cascade, double scale) {
-
-	static const cv::Scalar drawColor1 = cv::Scalar(255, 0, 0);
-	static const cv::Scalar drawColor2 = cv::Scalar(0, 0, 255);
+// the motor control loop runs at this rate on the predicted target position
+constexpr std::chrono::microseconds actuation_period { 2000 };
+// time from issuing a command until the turret has moved accordingly
+constexpr std::chrono::milliseconds actuation_delay { 30 };
 
-	Target target { INT32_MAX, INT32_MAX };
-	cv::Point frameCenter = { frame.cols / 2, frame.rows / 2 };
+constexpr PidSettings x_motor_gains {};
+constexpr PidSettings y_motor_gains {};
 
-	std::vector<cv::Rect> faces;
-	cv::Mat grayFrame, smallFrame;
+struct Frame {
+	cv::Mat image;
+	uint64_t sequence;
+	Clock::time_point captureTime;
+};
 
-	cv::cvtColor(frame, grayFrame, cv::COLOR_BGR2GRAY);
-	double fx = 1 / scale;
-	cv::resize(grayFrame, smallFrame, cv::Size(), fx, fx, cv::INTER_LINEAR);
-	cv::equalizeHist(smallFrame, smallFrame);
+struct Detection {
+	Target target;
+	cv::Point picCenter;
+	uint64_t sequence;
+	Clock::time_point captureTime;
+};
 
-	cascade.detectMultiScale(smallFrame, faces, 1.1, 2, cv::CASCADE_SCALE_IMAGE, cv::Size(30, 30));
+// every frame in flight plus the detection scratch buffers
+constexpr size_t frame_pool_capacity = 16;
+
+struct Pipeline {
+	FramePool pool { frame_pool_capacity };
+	LatestSlot<Frame> frames;
+	SpscQueue<Detection, 4> detections;
+	TargetTracker tracker;
+	ResolutionController resolution;
+	StageStats captureStats, detectStats, actuateStats;
+	std::atomic<bool> running { true };
+};
 
-	if (!faces.size()) {
-		return target;
+// capture stage latency is the time spent waiting on the camera
+static void CaptureLoop(Pipeline& pipeline, Camera& camera) {
+	uint64_t sequence = 0;
+	Frame stale;
+	while (pipeline.running.load(std::memory_order_relaxed)) {
+		Frame frame;
+		Clock::time_point start = Clock::now();
+		if (!camera.Read(frame.image, frame.captureTime)) {
+			std::cout << "camera frame was empty!" << std::endl;
+			break;
+		}
+		frame.sequence = sequence++;
+		pipeline.captureStats.Record(Clock::now() - start);
+		// a frame detection did not get to in time is dropped for the new one
+		if (pipeline.frames.Publish(std::move(frame), stale)) {
+			pipeline.detectStats.dropped++;
+			pipeline.pool.Release(stale.image);
+		}
 	}
+	pipeline.running = false;
+	pipeline.frames.Close();
+}
 
-	//std::cout << "detecting faces" << std::endl;
-
-	int32_t closestSqrMag = INT32_MAX;
-
-	for (cv::Rect& face : faces) {
-
-		std::vector<cv::Rect> nestedObjects;
-		cv::rectangle(frame, face, drawColor1, 3, 8, 0);
+// detect stage latency is the FindTarget cost, frames capture replaced before they were taken count as dropped
+// motion is nullptr to run the detector on every frame
+static void DetectLoop(Pipeline& pipeline, ObjectDetector& detector, MotionGate* motion, PreviewSink& preview) {
+	Frame frame;
+	std::vector<cv::Rect> faces;
+	faces.reserve(64);
+	while (pipeline.frames.WaitTake(frame)) {
+		DetectResolution resolution = pipeline.resolution.Next();
+		Clock::time_point start = Clock::now();
+		Detection detection {
+			FindTarget(frame.image, detector, pipeline.tracker, motion, resolution, pipeline.pool, faces),
+			{ frame.image.cols / 2, frame.image.rows / 2 },
+			frame.sequence,
+			frame.captureTime,
+		};
+		Clock::duration latency = Clock::now() - start;
+		pipeline.detectStats.Record(latency);
+		// a skipped frame says nothing about what detection costs
+		if (!motion || !motion->Skipped()) {
+			pipeline.resolution.Update(latency, pipeline.tracker);
+		}
+		Target target = detection.target;
+		if (!pipeline.detections.Push(std::move(detection))) {
+			pipeline.detectStats.dropped++;
+		}
+		if (!preview.Submit(frame.image, faces, resolution.scale, target, frame.captureTime)) {
+			pipeline.pool.Release(frame.image);
+		}
+	}
+	pipeline.detections.Close();
+}
 
-		cv::Point faceCenter;
-		faceCenter.x = cvRound((face.x + face.width * 0.5) * scale);
-		faceCenter.y = cvRound((face.y + face.height * 0.5) * scale);
+// actuate stage latency is end to end, from frame capture to the first motor command using it
+// the PID loop runs at a fixed rate on the predicted target, independent of the detection rate
+static void ActuateLoop(Pipeline& pipeline, MotorOutput& xSpeed, MotorOutput& ySpeed) {
+	piRtApply(actuation_subsystem);
+	TargetPredictor predictor;
+	PidController xController(x_motor_gains), yController(y_motor_gains);
+	MotorAxis xAxis { xSpeed, x_motor_0, x_motor_1 };
+	MotorAxis yAxis { ySpeed, y_motor_0, y_motor_1 };
+	Detection detection;
+	cv::Point picCenter;
+	Clock::time_point lastCommand = Clock::now();
+	Clock::time_point nextCommand = lastCommand;
+	while (pipeline.running.load(std::memory_order_relaxed)) {
+		int stale = pipeline.detections.PopLatest(detection);
+		if (stale >= 0) {
+			pipeline.actuateStats.dropped += stale;
+			predictor.Correct(detection.target, detection.captureTime);
+			picCenter = detection.picCenter;
+		}
 
-		Target newTarget = { frameCenter.x - faceCenter.x, frameCenter.y - faceCenter.y };
-		int32_t sqrMag = target.x * target.x + target.y * target.y;
+		Clock::time_point now = Clock::now();
+		float dt = std::chrono::duration<float>(now - lastCommand).count();
+		lastCommand = now;
+		Target target = predictor.Predict(now + actuation_delay);
+		float xError = 0.0f, yError = 0.0f;
+		if (target.x == INT32_MAX || target.y == INT32_MAX) {
+			xController.Reset();
+			yController.Reset();
+		}
+		else {
+			xError = (float)target.x / picCenter.x;
+			yError = (float)target.y / picCenter.y;
+		}
+		DriveAxes(xAxis, xController.Update(xError, dt), yAxis, yController.Update(yError, dt));
 
-		if (sqrMag < closestSqrMag) {
-			closestSqrMag = sqrMag;
-			target = newTarget;
+		if (stale >= 0) {
+			pipeline.actuateStats.Record(Clock::now() - detection.captureTime);
 		}
+		nextCommand = std::max(nextCommand + actuation_period, now);
+		std::this_thread::sleep_until(nextCommand);
 	}
+}
 
-	cv::circle(frame, { frameCenter.x - target.x, frameCenter.y - target.y }, 2, drawColor2, 3, 8, 0);
-
-	cv::imshow(window_name, frame);
+static void ReportStats(Pipeline& pipeline, MotionGate* motion, PreviewSink& preview, uint64_t& lastAllocations) {
+	uint64_t allocations = pipeline.pool.Allocations();
+	std::cout << "pool: " << allocations - lastAllocations << " allocations, "
+		<< pipeline.pool.Available() << " buffers free" << std::endl;
+	lastAllocations = allocations;
+	std::cout << "tracker: " << pipeline.tracker.fullScans.exchange(0, std::memory_order_relaxed) << " full scans, "
+		<< pipeline.tracker.windowScans.exchange(0, std::memory_order_relaxed) << " window scans, "
+		<< pipeline.tracker.regionScans.exchange(0, std::memory_order_relaxed) << " region scans, "
+		<< pipeline.tracker.templateMatches.exchange(0, std::memory_order_relaxed) << " template matches, scale "
+		<< pipeline.resolution.lastScale.load(std::memory_order_relaxed) << std::endl;
+	if (motion) {
+		std::cout << "motion: " << motion->skipped.exchange(0, std::memory_order_relaxed) << " frames skipped, "
+			<< motion->regionFrames.exchange(0, std::memory_order_relaxed) << " with regions, "
+			<< motion->fullFrames.exchange(0, std::memory_order_relaxed) << " full" << std::endl;
+	}
+	std::cout << "queues: frames " << pipeline.frames.Size() << ", detections " << pipeline.detections.Size()
+		<< ", previews " << preview.Pending() << std::endl;
+	pipeline.captureStats.Report(std::cout, "capture");
+	pipeline.detectStats.Report(std::cout, "detect");
+	pipeline.actuateStats.Report(std::cout, "actuate");
+}
 
-	target.y = frame.rows / 2 - (frame.rows - (frameCenter.y - target.y));
+static std::atomic<bool> interrupted { false };
 
-	return target;
+static void OnSignal(int) {
+	interrupted = true;
 }
 
-static inline int Clamp(int val, int min, int max) {
-	val = val > min ? val : min;
-	return val < max ? val : max;
+static void PrintUsage() {
+	std::cout << "usage: ant [--engine haar|lbp|hog|dnn|multi] [--model file] [--detect-threads count] [--detect-cpus list] "
+		"[--camera device] [--camera-size WxH] [--opencv-capture] [--mjpeg] [--jpeg-scale 1|2|4|8] [--record file.mjpeg] [--rt-cpus list] [--rt-policy fifo|rr] [--mlock] [--no-motion-gate] [--motion-refresh frames] [--headless] [--preview-file file.avi] [--preview-fps fps]" << std::endl;
 }
 
-static inline void RotateMotors(cv::Point picCenter, Target target) {
-	if (target.x == INT32_MAX || target.y == INT32_MAX) {
-		return;
-	}
-	int xSpeed = (int)Clamp(abs(target.x) / picCenter.x * 100, 0.0, 100.0);
-	int ySpeed = (int)Clamp(abs(target.y) / picCenter.y * 100, 0.0, 100.0);
-	if (target.x > 0) {
-		//move right
-		pinMode(x_motor_0, HIGH);
-		pinMode(x_motor_1, LOW);
-		softPwmWrite(x_motor_pwm, xSpeed);
-	}
-	else {
-		//move left
-		pinMode(x_motor_0, LOW);
-		pinMode(x_motor_1, HIGH);
-		softPwmWrite(x_motor_pwm, xSpeed);
-	}
-	if (target.y > 0) {
-		//move up
-		pinMode(y_motor_0, HIGH);
-		pinMode(y_motor_1, LOW);
-		softPwmWrite(y_motor_pwm, ySpeed);
-	}
-	else {
-		//mode down
-		pinMode(y_motor_0, LOW);
-		pinMode(y_motor_1, HIGH);
-		softPwmWrite(y_motor_pwm, ySpeed);
+int main(int argc, char** argv) {
+
+	PreviewSettings previewSettings;
+	std::string engine = "haar", model;
+	DetectorSettings detectorSettings;
+	RealtimeSettings realtimeSettings;
+	CameraSettings cameraSettings;
+	MotionSettings motionSettings;
+	bool motionGate = true;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--engine") && i + 1 < argc) {
+			engine = argv[++i];
+		}
+		else if (!strcmp(argv[i], "--model") && i + 1 < argc) {
+			model = argv[++i];
+		}
+		else if (!strcmp(argv[i], "--detect-threads") && i + 1 < argc) {
+			detectorSettings.threads = strtoul(argv[++i], nullptr, 10);
+		}
+		else if (!strcmp(argv[i], "--detect-cpus") && i + 1 < argc && ParseCpuList(argv[i + 1], detectorSettings.cpus)) {
+			i++;
+		}
+		else if (!strcmp(argv[i], "--camera") && i + 1 < argc) {
+			cameraSettings.device = argv[++i];
+		}
+		else if (!strcmp(argv[i], "--camera-size") && i + 1 < argc && sscanf(argv[i + 1], "%dx%d", &cameraSettings.size.width, &cameraSettings.size.height) == 2) {
+			i++;
+		}
+		else if (!strcmp(argv[i], "--opencv-capture")) {
+			cameraSettings.v4l2 = false;
+		}
+		else if (!strcmp(argv[i], "--mjpeg")) {
+			cameraSettings.mjpeg = true;
+		}
+		else if (!strcmp(argv[i], "--jpeg-scale") && i + 1 < argc && strchr("1248", argv[i + 1][0]) && !argv[i + 1][1]) {
+			cameraSettings.jpegScale = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "--record") && i + 1 < argc) {
+			cameraSettings.record = argv[++i];
+		}
+		else if (!strcmp(argv[i], "--rt-cpus") && i + 1 < argc && ParseCpuList(argv[i + 1], realtimeSettings.cpus)) {
+			i++;
+		}
+		else if (!strcmp(argv[i], "--rt-policy") && i + 1 < argc && (!strcmp(argv[i + 1], "fifo") || !strcmp(argv[i + 1], "rr"))) {
+			realtimeSettings.policy = !strcmp(argv[++i], "fifo") ? SCHED_FIFO : SCHED_RR;
+		}
+		else if (!strcmp(argv[i], "--mlock")) {
+			realtimeSettings.lockMemory = true;
+		}
+		else if (!strcmp(argv[i], "--no-motion-gate")) {
+			motionGate = false;
+		}
+		else if (!strcmp(argv[i], "--motion-refresh") && i + 1 < argc) {
+			motionSettings.refreshInterval = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "--headless")) {
+			previewSettings.window = false;
+		}
+		else if (!strcmp(argv[i], "--preview-file") && i + 1 < argc) {
+			previewSettings.file = argv[++i];
+		}
+		else if (!strcmp(argv[i], "--preview-fps") && i + 1 < argc) {
+			previewSettings.fps = atof(argv[++i]);
+		}
+		else {
+			PrintUsage();
+			return -1;
+		}
 	}
-}
 
-int main() {
+	std::signal(SIGINT, OnSignal);
+	std::signal(SIGTERM, OnSignal);
+
+	for (int cpu : detectorSettings.cpus) {
+		if (std::find(realtimeSettings.cpus.begin(), realtimeSettings.cpus.end(), cpu) != realtimeSettings.cpus.end()) {
+			std::cout << "detection worker pinned to real-time cpu " << cpu << "!" << std::endl;
+		}
+	}
+	// before any thread is started, they inherit the main thread's placement
+	ConfigureRealtime(realtimeSettings);
 
 	wiringPiSetupGpio();
 	wiringPiSetup();
 
 	pinMode(x_motor_0, OUTPUT);
 	pinMode(x_motor_1, OUTPUT);
-	softPwmCreate(x_motor_pwm, 0, 100);
+	std::unique_ptr<MotorOutput> xSpeed = CreateMotorOutput(x_motor_pwm);
 
 	pinMode(y_motor_0, OUTPUT);
 	pinMode(y_motor_1, OUTPUT);
-	softPwmCreate(y_motor_pwm, 0, 100);
+	std::unique_ptr<MotorOutput> ySpeed = CreateMotorOutput(y_motor_pwm);
+
+	std::cout << "motor pwm: x " << (xSpeed->Hardware() ? "hardware" : "software") << ", y "
+		<< (ySpeed->Hardware() ? "hardware" : "software") << std::endl;
 
 	digitalWrite(y_motor_0, LOW);
 	digitalWrite(y_motor_1, LOW);
 	digitalWrite(x_motor_0, LOW);
 	digitalWrite(x_motor_1, LOW);
 
-	cv::VideoCapture camCapture;
-	cv::Mat camFrame;
-	cv::CascadeClassifier cascade;
-	cascade.load("opencv/data/haarcascades/haarcascade_frontalface_default.xml");
+	std::unique_ptr<ObjectDetector> detector = CreateDetector(engine, model, detectorSettings);
 
-	if (cascade.empty()) {
-		std::cout << "failed to open face cascade file!" << std::endl;
+	if (!detector) {
+		std::cout << "failed to create " << engine << " detector!" << std::endl;
 		return -1;
 	}
 
-	camCapture.open(0);
+	Pipeline pipeline;
+	std::unique_ptr<Camera> camera = CreateCamera(cameraSettings, pipeline.pool);
 
-	if (!camCapture.isOpened()) {
+	if (!camera) {
 		std::cout << "failed to start camera capture!" << std::endl;
 		return -1;
 	}
+	std::cout << "camera: " << camera->Describe() << std::endl;
 
-	cv::namedWindow(window_name);
+	MotionGate motion(motionSettings);
+	MotionGate* gate = motionGate ? &motion : nullptr;
 
+	PreviewSink preview(pipeline.pool, previewSettings);
+	std::thread captureThread(CaptureLoop, std::ref(pipeline), std::ref(*camera));
+	std::thread detectThread(DetectLoop, std::ref(pipeline), std::ref(*detector), gate, std::ref(preview));
+	std::thread actuateThread(ActuateLoop, std::ref(pipeline), std::ref(*xSpeed), std::ref(*ySpeed));
 
-	while (camCapture.isOpened() && cv::getWindowProperty(window_name, cv::WindowPropertyFlags::WND_PROP_VISIBLE)) {
-		camCapture >> camFrame;
-		if (camFrame.empty()) {
-			std::cout << "camera frame was empty!" << std::endl;
-			break;
+	// a preview window has to be serviced from the main thread, a file-only preview gets its own
+	std::thread previewThread;
+	if (preview.Enabled() && !previewSettings.window) {
+		previewThread = std::thread(&PreviewSink::Run, &preview);
+	}
+
+	Clock::time_point lastReport = Clock::now();
+	uint64_t lastAllocations = 0;
+	while (pipeline.running.load(std::memory_order_relaxed) && !interrupted.load(std::memory_order_relaxed)) {
+		if (previewSettings.window) {
+			if (!preview.Update()) {
+				break;
+			}
+		}
+		else {
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		}
+		if (Clock::now() - lastReport >= std::chrono::seconds(1)) {
+			ReportStats(pipeline, gate, preview, lastAllocations);
+			lastReport = Clock::now();
 		}
-		int resolution[2] = { camFrame.rows, camFrame.cols };
-		RotateMotors({ camFrame.cols / 2, camFrame.rows / 2 }, FindTarget(camFrame, cascade, 1.0));
-		cv::pollKey();
 	}
 
-	if (cv::getWindowProperty(window_name, cv::WindowPropertyFlags::WND_PROP_VISIBLE)) {
-		cv::destroyWindow("Face");
+	pipeline.running = false;
+	captureThread.join();
+	detectThread.join();
+	actuateThread.join();
+	preview.Close();
+	if (previewThread.joinable()) {
+		previewThread.join();
 	}
 
-	softPwmWrite(x_motor_pwm, 0);
-	softPwmWrite(y_motor_pwm, 0);
+	xSpeed->Write(0.0f);
+	ySpeed->Write(0.0f);
 
 	digitalWrite(y_motor_0, LOW);
 	digitalWrite(y_motor_1, LOW);
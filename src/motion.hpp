@@ -0,0 +1,134 @@
+#pragma once
+
+#include "opencv2/core.hpp"
+#include "opencv2/imgproc.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+struct MotionSettings {
+	int cellSize = 16; // frame pixels per side of a difference cell
+	int threshold = 8; // change of a cell's mean gray level that counts as motion
+	int padding = 2; // cells added around each changed region
+	double maxCoverage = 0.4; // above this fraction of changed cells the whole frame is scanned
+	int refreshInterval = 30; // frames between scans that run whether anything moved or not
+};
+
+// Frame-differencing gate in front of the detector while nothing is tracked. Every
+// frame is shrunk to one mean gray value per cell and compared with the cells of the
+// frame the detector last ran on. A static scene skips detection entirely, changed
+// cells are grouped into padded regions that get scanned instead of the whole frame.
+// Averaging over a cell hides sensor noise, and comparing against the last scanned
+// frame instead of the previous one lets slow changes add up until they are scanned.
+// Every refreshInterval frames, and after Reset, the whole frame is scanned regardless.
+class MotionGate {
+public:
+
+	enum class Decision {
+		Skip,
+		Regions,
+		Full,
+	};
+
+	explicit MotionGate(MotionSettings settings = {}) : settings(settings) {}
+
+	Decision Update(const cv::Mat& frame) {
+		regions.clear();
+		cv::Size cells((frame.cols + settings.cellSize - 1) / settings.cellSize, (frame.rows + settings.cellSize - 1) / settings.cellSize);
+		if (frame.channels() == 3) {
+			cv::resize(frame, shrunkColor, cells, 0, 0, cv::INTER_AREA);
+			cv::cvtColor(shrunkColor, shrunk, cv::COLOR_BGR2GRAY);
+		}
+		else {
+			cv::resize(frame, shrunk, cells, 0, 0, cv::INTER_AREA);
+		}
+
+		if (!hasReference || reference.size() != shrunk.size() || ++framesSinceRefresh >= settings.refreshInterval) {
+			return Scan(Decision::Full);
+		}
+
+		cv::absdiff(shrunk, reference, difference);
+		cv::threshold(difference, changed, settings.threshold, 255, cv::THRESH_BINARY);
+		int changedCells = cv::countNonZero(changed);
+		if (!changedCells) {
+			last = Decision::Skip;
+			skipped.fetch_add(1, std::memory_order_relaxed);
+			return last;
+		}
+		if (changedCells > settings.maxCoverage * cells.area()) {
+			return Scan(Decision::Full);
+		}
+
+		int count = cv::connectedComponentsWithStats(changed, labels, stats, centroids, 8, CV_32S);
+		cv::Rect frameRect(0, 0, frame.cols, frame.rows);
+		for (int i = 1; i < count; i++) {
+			cv::Rect region(
+				(stats.at<int>(i, cv::CC_STAT_LEFT) - settings.padding) * settings.cellSize,
+				(stats.at<int>(i, cv::CC_STAT_TOP) - settings.padding) * settings.cellSize,
+				(stats.at<int>(i, cv::CC_STAT_WIDTH) + 2 * settings.padding) * settings.cellSize,
+				(stats.at<int>(i, cv::CC_STAT_HEIGHT) + 2 * settings.padding) * settings.cellSize);
+			Add(region & frameRect);
+		}
+		regionFrames.fetch_add(1, std::memory_order_relaxed);
+		return Scan(Decision::Regions);
+	}
+
+	// forgets the reference so the next Update scans the whole frame, used while the
+	// tracker holds a target and the gate is bypassed
+	void Reset() {
+		hasReference = false;
+		last = Decision::Full;
+	}
+
+	// changed parts of the last frame in frame coordinates, only set for Decision::Regions
+	const std::vector<cv::Rect>& Regions() const {
+		return regions;
+	}
+
+	// true if the last Update skipped detection
+	bool Skipped() const {
+		return last == Decision::Skip;
+	}
+
+	std::atomic<uint64_t> skipped { 0 };
+	std::atomic<uint64_t> regionFrames { 0 };
+	std::atomic<uint64_t> fullFrames { 0 };
+
+private:
+
+	Decision Scan(Decision decision) {
+		if (decision == Decision::Full) {
+			framesSinceRefresh = 0;
+			fullFrames.fetch_add(1, std::memory_order_relaxed);
+		}
+		shrunk.copyTo(reference);
+		hasReference = true;
+		last = decision;
+		return decision;
+	}
+
+	// merges region into any it overlaps after padding, so a face is not scanned twice
+	void Add(cv::Rect region) {
+		bool merged = true;
+		while (merged) {
+			merged = false;
+			for (size_t i = 0; i < regions.size(); i++) {
+				if ((regions[i] & region).area()) {
+					region |= regions[i];
+					regions.erase(regions.begin() + i);
+					merged = true;
+					break;
+				}
+			}
+		}
+		regions.push_back(region);
+	}
+
+	MotionSettings settings;
+	cv::Mat shrunkColor, shrunk, reference, difference, changed, labels, stats, centroids;
+	std::vector<cv::Rect> regions;
+	bool hasReference = false;
+	int framesSinceRefresh = 0;
+	Decision last = Decision::Full;
+};
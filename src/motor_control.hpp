@@ -0,0 +1,108 @@
+#pragma once
+
+#include "wiringPi.h"
+#include "motor_output.hpp"
+#include <algorithm>
+#include <cmath>
+
+struct PidSettings {
+	float kp = 80.0f; // output percent per unit of normalized error (1 = frame edge)
+	float ki = 20.0f;
+	float kd = 4.0f;
+	float deadband = 0.03f; // normalized error treated as on target
+	float outputLimit = 100.0f; // percent duty
+	float slewRate = 500.0f; // max output change in percent per second
+};
+
+// Per-axis PID with deadband, conditional-integration anti-windup and output slew
+// limiting. Error is the target offset normalized to the half frame, the output is a
+// signed duty in percent whose sign selects the motor direction.
+class PidController {
+public:
+
+	explicit PidController(PidSettings settings = {}) : settings(settings) {}
+
+	float Update(float error, float dt) {
+		if (dt <= 0.0f) {
+			return output;
+		}
+		if (std::abs(error) < settings.deadband) {
+			error = 0.0f;
+		}
+		float derivative = hasPrevious ? (error - previousError) / dt : 0.0f;
+		previousError = error;
+		hasPrevious = true;
+
+		// stop integrating while saturated unless the error would pull the output back
+		float integrated = integral + error * dt;
+		float unclamped = settings.kp * error + settings.ki * integrated + settings.kd * derivative;
+		if (std::abs(unclamped) <= settings.outputLimit || (unclamped > 0.0f) != (error > 0.0f)) {
+			integral = integrated;
+		}
+
+		float command = std::clamp(settings.kp * error + settings.ki * integral + settings.kd * derivative,
+			-settings.outputLimit, settings.outputLimit);
+		float step = settings.slewRate * dt;
+		output = std::clamp(command, output - step, output + step);
+		return output;
+	}
+
+	// clears integral and derivative history, the output still slews down from where it is
+	void Reset() {
+		integral = 0.0f;
+		hasPrevious = false;
+	}
+
+	float Output() const {
+		return output;
+	}
+
+private:
+
+	PidSettings settings;
+	float integral = 0.0f;
+	float previousError = 0.0f;
+	float output = 0.0f;
+	bool hasPrevious = false;
+};
+
+// H-bridge channel: a PWM output for speed and two direction pins (wiringPi numbering).
+// Direction pins are only written when the sign of the output changes.
+struct MotorAxis {
+
+	MotorOutput& speed;
+	int pin0, pin1;
+	int direction = 0;
+
+	// adds the direction pin changes for output to the GPIO masks
+	void Direction(float output, unsigned int& setMask, unsigned int& clearMask) {
+		int newDirection = output > 0.0f ? 1 : output < 0.0f ? -1 : 0;
+		if (newDirection == direction) {
+			return;
+		}
+		unsigned int bit0 = 1u << wpiPinToGpio(pin0);
+		unsigned int bit1 = 1u << wpiPinToGpio(pin1);
+		(newDirection > 0 ? setMask : clearMask) |= bit0;
+		(newDirection < 0 ? setMask : clearMask) |= bit1;
+		direction = newDirection;
+	}
+
+	void Drive(float output) {
+		unsigned int setMask = 0, clearMask = 0;
+		Direction(output, setMask, clearMask);
+		digitalWriteMask(setMask, clearMask);
+		speed.Write(std::abs(output));
+	}
+};
+
+// Drives both axes, the direction pins of both change in one digitalWriteMask call:
+// pins going low are cleared in one write and the others set in the next, so an
+// H-bridge reversing passes through brake instead of shorting.
+inline void DriveAxes(MotorAxis& xAxis, float xOutput, MotorAxis& yAxis, float yOutput) {
+	unsigned int setMask = 0, clearMask = 0;
+	xAxis.Direction(xOutput, setMask, clearMask);
+	yAxis.Direction(yOutput, setMask, clearMask);
+	digitalWriteMask(setMask, clearMask);
+	xAxis.speed.Write(std::abs(xOutput));
+	yAxis.speed.Write(std::abs(yOutput));
+}
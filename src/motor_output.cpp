@@ -0,0 +1,88 @@
+#include "motor_output.hpp"
+#include "wiringPi.h"
+#include "softPwm.h"
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// PWM peripheral clock before the divisor, wiringPi rescales divisors on boards with a different oscillator
+constexpr int pwm_base_clock = 19200000;
+// counts per period, 2 * 480 * 20 kHz = 19.2 MHz
+constexpr int pwm_divisor = 2;
+constexpr int pwm_range = pwm_base_clock / pwm_divisor / motor_pwm_frequency;
+
+constexpr int soft_pwm_range = 100;
+
+// BCM GPIOs with a PWM alternate function on the 40-pin header
+static bool HasHardwarePwm(int gpio) {
+	return gpio == 12 || gpio == 13 || gpio == 18 || gpio == 19;
+}
+
+class HardwareMotorOutput : public MotorOutput {
+public:
+
+	explicit HardwareMotorOutput(int pin) : pin(pin) {
+		pinMode(pin, PWM_MS_OUTPUT);
+		// range and clock are common to both channels, programming them again is harmless
+		pwmSetRange(pwm_range);
+		pwmSetClock(pwm_divisor);
+		pwmWrite(pin, 0);
+	}
+
+	~HardwareMotorOutput() override {
+		pwmWrite(pin, 0);
+		pinMode(pin, PM_OFF);
+	}
+
+	void Write(float duty) override {
+		pwmWrite(pin, (int)std::lround(std::clamp(duty, 0.0f, 100.0f) * pwm_range / 100));
+	}
+
+	bool Hardware() const override {
+		return true;
+	}
+
+private:
+
+	int pin;
+};
+
+class SoftMotorOutput : public MotorOutput {
+public:
+
+	explicit SoftMotorOutput(int pin) : pin(pin) {
+		softPwmCreate(pin, 0, soft_pwm_range);
+	}
+
+	~SoftMotorOutput() override {
+		softPwmWrite(pin, 0);
+		softPwmStop(pin);
+	}
+
+	void Write(float duty) override {
+		softPwmWrite(pin, (int)std::lround(duty * soft_pwm_range / 100));
+	}
+
+	bool Hardware() const override {
+		return false;
+	}
+
+private:
+
+	int pin;
+};
+
+std::unique_ptr<MotorOutput> CreateMotorOutput(int pin) {
+	int gpio = wpiPinToGpio(pin);
+	if (!HasHardwarePwm(gpio)) {
+		std::cout << "motor pin " << pin << " (BCM " << gpio << ") has no hardware PWM, using softPwm!" << std::endl;
+		return std::make_unique<SoftMotorOutput>(pin);
+	}
+	// with only /dev/gpiomem the PWM and clock registers are not mapped
+	if (geteuid() != 0 || !_wiringPiPwm || !_wiringPiClk) {
+		std::cout << "motor pin " << pin << " (BCM " << gpio << ") needs root for hardware PWM, using softPwm!" << std::endl;
+		return std::make_unique<SoftMotorOutput>(pin);
+	}
+	return std::make_unique<HardwareMotorOutput>(pin);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <memory>
+
+// Speed output of one motor channel.
+class MotorOutput {
+public:
+
+	virtual ~MotorOutput() = default;
+
+	// duty in percent, 0 to 100
+	virtual void Write(float duty) = 0;
+
+	// true if the pulses come from the PWM peripheral rather than a software thread
+	virtual bool Hardware() const = 0;
+};
+
+// hardware PWM frequency, shared by every hardware channel
+constexpr int motor_pwm_frequency = 20000;
+
+// Drives pin (wiringPi numbering) from the PWM peripheral when the pin has a PWM
+// function and the process may program it (root, full /dev/mem access), otherwise
+// falls back to softPwm. The output starts at 0 and is stopped when destroyed.
+std::unique_ptr<MotorOutput> CreateMotorOutput(int pin);
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <utility>
+
+using Clock = std::chrono::steady_clock;
+
+// Bounded lock-free single-producer/single-consumer ring. The consumer drains to the
+// newest entry with PopLatest so downstream stages always act on the freshest data,
+// and a full ring rejects the push instead of blocking the producer.
+template<typename T, size_t Capacity>
+class SpscQueue {
+public:
+
+	static_assert(Capacity && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+	bool Push(T&& value) {
+		size_t tail = tailIndex.load(std::memory_order_relaxed);
+		if (tail - headIndex.load(std::memory_order_acquire) == Capacity) {
+			return false;
+		}
+		slots[tail & (Capacity - 1)] = std::move(value);
+		tailIndex.store(tail + 1, std::memory_order_release);
+		Signal();
+		return true;
+	}
+
+	bool Pop(T& out) {
+		size_t head = headIndex.load(std::memory_order_relaxed);
+		if (head == tailIndex.load(std::memory_order_acquire)) {
+			return false;
+		}
+		out = std::move(slots[head & (Capacity - 1)]);
+		headIndex.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	// pops everything currently queued, keeping the newest entry in out and handing
+	// skipped ones to discard so pooled resources can be returned
+	// returns the number of stale entries skipped, or -1 if the queue was empty
+	template<typename Discard>
+	int PopLatest(T& out, Discard&& discard) {
+		if (!Pop(out)) {
+			return -1;
+		}
+		int stale = 0;
+		T next;
+		while (Pop(next)) {
+			discard(out);
+			out = std::move(next);
+			stale++;
+		}
+		return stale;
+	}
+
+	int PopLatest(T& out) {
+		return PopLatest(out, [](T&) {});
+	}
+
+	// blocks until an entry is available or the queue is closed and drained
+	template<typename Discard>
+	bool WaitPopLatest(T& out, int& stale, Discard&& discard) {
+		for (;;) {
+			uint32_t seen = signal.load(std::memory_order_acquire);
+			stale = PopLatest(out, discard);
+			if (stale >= 0) {
+				return true;
+			}
+			if (closed.load(std::memory_order_acquire)) {
+				// the producer may have pushed its last entry just before closing
+				stale = PopLatest(out, discard);
+				return stale >= 0;
+			}
+			signal.wait(seen, std::memory_order_acquire);
+		}
+	}
+
+	bool WaitPopLatest(T& out, int& stale) {
+		return WaitPopLatest(out, stale, [](T&) {});
+	}
+
+	void Close() {
+		closed.store(true, std::memory_order_release);
+		Signal();
+	}
+
+	size_t Size() const {
+		return tailIndex.load(std::memory_order_acquire) - headIndex.load(std::memory_order_acquire);
+	}
+
+private:
+
+	void Signal() {
+		signal.fetch_add(1, std::memory_order_release);
+		signal.notify_one();
+	}
+
+	alignas(64) std::atomic<size_t> headIndex { 0 };
+	alignas(64) std::atomic<size_t> tailIndex { 0 };
+	alignas(64) std::atomic<uint32_t> signal { 0 };
+	std::atomic<bool> closed { false };
+	std::array<T, Capacity> slots;
+};
+
+// Lock-free single-producer/single-consumer slot that only holds the newest entry, a
+// triple buffer: the producer fills its own slot and swaps it with the shared one, the
+// consumer swaps its slot with the shared one when that holds something new. Publishing
+// over an entry the consumer has not taken yet hands that stale entry back to the
+// producer, so a slow consumer always gets the freshest entry and the stale one can be
+// returned to its pool. Taken slots are left moved-from, holding no resources.
+template<typename T>
+class LatestSlot {
+public:
+
+	// returns true if an entry the consumer never took was replaced, it is moved to stale
+	bool Publish(T&& value, T& stale) {
+		slots[back] = std::move(value);
+		uint32_t previous = shared.exchange(back | fresh_bit, std::memory_order_acq_rel);
+		back = previous & index_mask;
+		Signal();
+		if (!(previous & fresh_bit)) {
+			return false;
+		}
+		stale = std::move(slots[back]);
+		return true;
+	}
+
+	bool Take(T& out) {
+		if (!(shared.load(std::memory_order_acquire) & fresh_bit)) {
+			return false;
+		}
+		front = shared.exchange(front, std::memory_order_acq_rel) & index_mask;
+		out = std::move(slots[front]);
+		return true;
+	}
+
+	// blocks until an entry is available or the slot is closed and empty
+	bool WaitTake(T& out) {
+		for (;;) {
+			uint32_t seen = signal.load(std::memory_order_acquire);
+			if (Take(out)) {
+				return true;
+			}
+			if (closed.load(std::memory_order_acquire)) {
+				// the producer may have published its last entry just before closing
+				return Take(out);
+			}
+			signal.wait(seen, std::memory_order_acquire);
+		}
+	}
+
+	void Close() {
+		closed.store(true, std::memory_order_release);
+		Signal();
+	}
+
+	// 1 while an entry waits to be taken
+	size_t Size() const {
+		return (shared.load(std::memory_order_acquire) & fresh_bit) ? 1 : 0;
+	}
+
+private:
+
+	static constexpr uint32_t fresh_bit = 4;
+	static constexpr uint32_t index_mask = 3;
+
+	void Signal() {
+		signal.fetch_add(1, std::memory_order_release);
+		signal.notify_one();
+	}
+
+	std::array<T, 3> slots;
+	uint32_t back = 0; // producer's slot
+	alignas(64) uint32_t front = 1; // consumer's slot
+	alignas(64) std::atomic<uint32_t> shared { 2 };
+	alignas(64) std::atomic<uint32_t> signal { 0 };
+	std::atomic<bool> closed { false };
+};
+
+// Per-stage counters, written by the stage thread and read/reset by the reporter.
+struct StageStats {
+
+	std::atomic<uint64_t> processed { 0 };
+	std::atomic<uint64_t> dropped { 0 };
+	std::atomic<uint64_t> latencyTotalUs { 0 };
+	std::atomic<uint64_t> latencyMaxUs { 0 };
+
+	void Record(Clock::duration latency) {
+		uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+		processed.fetch_add(1, std::memory_order_relaxed);
+		latencyTotalUs.fetch_add(us, std::memory_order_relaxed);
+		uint64_t max = latencyMaxUs.load(std::memory_order_relaxed);
+		while (us > max && !latencyMaxUs.compare_exchange_weak(max, us, std::memory_order_relaxed)) {}
+	}
+
+	void Report(std::ostream& out, const char* name) {
+		uint64_t count = processed.exchange(0, std::memory_order_relaxed);
+		uint64_t total = latencyTotalUs.exchange(0, std::memory_order_relaxed);
+		uint64_t max = latencyMaxUs.exchange(0, std::memory_order_relaxed);
+		out << name << ": " << count << " processed, " << dropped.exchange(0, std::memory_order_relaxed)
+			<< " dropped, latency avg " << (count ? total / count : 0)
+			<< " us max " << max << " us" << std::endl;
+	}
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "opencv2/core.hpp"
+#include "opencv2/video/tracking.hpp"
+#include "pipeline.hpp"
+#include "target.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+struct PredictorSettings {
+	float accelerationNoise = 2000.0f; // px/s^2, how hard the target is allowed to swerve
+	float measurementNoise = 16.0f; // px^2, detector jitter
+	std::chrono::milliseconds maxLead { 250 }; // never extrapolate further than this
+	std::chrono::milliseconds lostTimeout { 500 }; // forget the target after this long without a detection
+};
+
+// Constant-velocity Kalman filter over the target centre. Detections are fed in with
+// their capture timestamps and the state can be extrapolated to any later time, so
+// motor commands lead a moving target by the capture, detection and actuation delay
+// instead of chasing where it was, and can be issued more often than detections arrive.
+class TargetPredictor {
+public:
+
+	explicit TargetPredictor(PredictorSettings settings = {}) : settings(settings), kalman(4, 2, 0, CV_32F), measurement(2, 1) {
+		cv::setIdentity(kalman.measurementMatrix);
+		cv::setIdentity(kalman.measurementNoiseCov, cv::Scalar(settings.measurementNoise));
+		cv::setIdentity(kalman.transitionMatrix);
+	}
+
+	void Correct(Target target, Clock::time_point captureTime) {
+		if (target.x == INT32_MAX || target.y == INT32_MAX) {
+			return;
+		}
+		if (!Tracking(captureTime)) {
+			kalman.statePost.at<float>(0) = (float)target.x;
+			kalman.statePost.at<float>(1) = (float)target.y;
+			kalman.statePost.at<float>(2) = 0.0f;
+			kalman.statePost.at<float>(3) = 0.0f;
+			cv::setIdentity(kalman.errorCovPost, cv::Scalar(settings.measurementNoise));
+			kalman.errorCovPost.at<float>(2, 2) = kalman.errorCovPost.at<float>(3, 3) = 1e6f;
+			lastTime = captureTime;
+			initialized = true;
+			return;
+		}
+		float dt = std::chrono::duration<float>(captureTime - lastTime).count();
+		if (dt <= 0.0f) {
+			return;
+		}
+		SetInterval(dt);
+		kalman.predict();
+		measurement(0) = (float)target.x;
+		measurement(1) = (float)target.y;
+		kalman.correct(measurement);
+		lastTime = captureTime;
+	}
+
+	// target position extrapolated to time, or INT32_MAX if nothing is being tracked
+	Target Predict(Clock::time_point time) const {
+		if (!Tracking(time)) {
+			return { INT32_MAX, INT32_MAX };
+		}
+		float dt = std::chrono::duration<float>(std::min<Clock::duration>(time - lastTime, settings.maxLead)).count();
+		const cv::Mat& state = kalman.statePost;
+		return {
+			cvRound(state.at<float>(0) + state.at<float>(2) * dt),
+			cvRound(state.at<float>(1) + state.at<float>(3) * dt),
+		};
+	}
+
+	bool Tracking(Clock::time_point time) const {
+		return initialized && time - lastTime <= settings.lostTimeout;
+	}
+
+private:
+
+	// transition and white-noise-acceleration process noise for a step of dt seconds
+	void SetInterval(float dt) {
+		kalman.transitionMatrix.at<float>(0, 2) = dt;
+		kalman.transitionMatrix.at<float>(1, 3) = dt;
+		float q = settings.accelerationNoise * settings.accelerationNoise;
+		float dt2 = dt * dt;
+		cv::Mat& noise = kalman.processNoiseCov;
+		noise = cv::Scalar(0);
+		for (int axis = 0; axis < 2; axis++) {
+			noise.at<float>(axis, axis) = q * dt2 * dt2 / 4;
+			noise.at<float>(axis, axis + 2) = q * dt2 * dt / 2;
+			noise.at<float>(axis + 2, axis) = q * dt2 * dt / 2;
+			noise.at<float>(axis + 2, axis + 2) = q * dt2;
+		}
+	}
+
+	PredictorSettings settings;
+	cv::KalmanFilter kalman;
+	cv::Mat1f measurement;
+	Clock::time_point lastTime;
+	bool initialized = false;
+};
@@ -0,0 +1,403 @@
+#include "preprocess.hpp"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ANT_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+	// OpenCV's BT.601 gray coefficients, 14 bit fixed point
+	constexpr int gray_shift = 14;
+	constexpr int gray_b = 1868, gray_g = 9617, gray_r = 4899;
+	constexpr int gray_round = 1 << (gray_shift - 1);
+
+	// bilinear weights are 8.8 fixed point, the vertical blend 16.16
+	constexpr int weight_one = 256;
+
+	typedef void (*GrayRowFunction)(const uint8_t* bgr, uint8_t* gray, int width);
+	typedef void (*BlendRowFunction)(const uint16_t* line0, const uint16_t* line1, int weight1, uint8_t* dst, int width);
+
+	void GrayRowScalar(const uint8_t* bgr, uint8_t* gray, int width) {
+		for (int x = 0; x < width; x++, bgr += 3) {
+			gray[x] = (uint8_t)((bgr[0] * gray_b + bgr[1] * gray_g + bgr[2] * gray_r + gray_round) >> gray_shift);
+		}
+	}
+
+	void BlendRowScalar(const uint16_t* line0, const uint16_t* line1, int weight1, uint8_t* dst, int width) {
+		uint32_t weight0 = weight_one - weight1;
+		for (int x = 0; x < width; x++) {
+			dst[x] = (uint8_t)((line0[x] * weight0 + line1[x] * (uint32_t)weight1 + (1 << 15)) >> 16);
+		}
+	}
+
+#ifdef ANT_X86
+
+	// splits 16 packed BGR pixels into their channels
+	__attribute__((target("ssse3")))
+	inline void Deinterleave(const uint8_t* bgr, __m128i& b, __m128i& g, __m128i& r) {
+		__m128i p0 = _mm_loadu_si128((const __m128i*)bgr);
+		__m128i p1 = _mm_loadu_si128((const __m128i*)(bgr + 16));
+		__m128i p2 = _mm_loadu_si128((const __m128i*)(bgr + 32));
+		b = _mm_or_si128(_mm_or_si128(
+			_mm_shuffle_epi8(p0, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+			_mm_shuffle_epi8(p1, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1))),
+			_mm_shuffle_epi8(p2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)));
+		g = _mm_or_si128(_mm_or_si128(
+			_mm_shuffle_epi8(p0, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+			_mm_shuffle_epi8(p1, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1))),
+			_mm_shuffle_epi8(p2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)));
+		r = _mm_or_si128(_mm_or_si128(
+			_mm_shuffle_epi8(p0, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+			_mm_shuffle_epi8(p1, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1))),
+			_mm_shuffle_epi8(p2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)));
+	}
+
+	// b * gray_b + g * gray_g and r * gray_r + gray_round are pairwise multiply-adds
+	__attribute__((target("ssse3")))
+	void GrayRowSse(const uint8_t* bgr, uint8_t* gray, int width) {
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i one = _mm_set1_epi16(1);
+		const __m128i bgWeights = _mm_set1_epi32(gray_b | (gray_g << 16));
+		const __m128i rWeights = _mm_set1_epi32(gray_r | (gray_round << 16));
+		int x = 0;
+		for (; x + 16 <= width; x += 16, bgr += 48) {
+			__m128i b, g, r;
+			Deinterleave(bgr, b, g, r);
+			__m128i sums[4];
+			for (int half = 0; half < 2; half++) {
+				__m128i b16 = half ? _mm_unpackhi_epi8(b, zero) : _mm_unpacklo_epi8(b, zero);
+				__m128i g16 = half ? _mm_unpackhi_epi8(g, zero) : _mm_unpacklo_epi8(g, zero);
+				__m128i r16 = half ? _mm_unpackhi_epi8(r, zero) : _mm_unpacklo_epi8(r, zero);
+				sums[half * 2] = _mm_srli_epi32(_mm_add_epi32(
+					_mm_madd_epi16(_mm_unpacklo_epi16(b16, g16), bgWeights),
+					_mm_madd_epi16(_mm_unpacklo_epi16(r16, one), rWeights)), gray_shift);
+				sums[half * 2 + 1] = _mm_srli_epi32(_mm_add_epi32(
+					_mm_madd_epi16(_mm_unpackhi_epi16(b16, g16), bgWeights),
+					_mm_madd_epi16(_mm_unpackhi_epi16(r16, one), rWeights)), gray_shift);
+			}
+			__m128i result = _mm_packus_epi16(_mm_packs_epi32(sums[0], sums[1]), _mm_packs_epi32(sums[2], sums[3]));
+			_mm_storeu_si128((__m128i*)(gray + x), result);
+		}
+		GrayRowScalar(bgr, gray + x, width - x);
+	}
+
+	// same multiply-adds on 16 pixels per register
+	__attribute__((target("avx2")))
+	void GrayRowAvx2(const uint8_t* bgr, uint8_t* gray, int width) {
+		const __m256i one = _mm256_set1_epi16(1);
+		const __m256i bgWeights = _mm256_set1_epi32(gray_b | (gray_g << 16));
+		const __m256i rWeights = _mm256_set1_epi32(gray_r | (gray_round << 16));
+		int x = 0;
+		for (; x + 16 <= width; x += 16, bgr += 48) {
+			__m128i b, g, r;
+			Deinterleave(bgr, b, g, r);
+			__m256i b16 = _mm256_cvtepu8_epi16(b);
+			__m256i g16 = _mm256_cvtepu8_epi16(g);
+			__m256i r16 = _mm256_cvtepu8_epi16(r);
+			// unpack and pack both work per 128 bit lane, so the pixel order survives
+			__m256i low = _mm256_srli_epi32(_mm256_add_epi32(
+				_mm256_madd_epi16(_mm256_unpacklo_epi16(b16, g16), bgWeights),
+				_mm256_madd_epi16(_mm256_unpacklo_epi16(r16, one), rWeights)), gray_shift);
+			__m256i high = _mm256_srli_epi32(_mm256_add_epi32(
+				_mm256_madd_epi16(_mm256_unpackhi_epi16(b16, g16), bgWeights),
+				_mm256_madd_epi16(_mm256_unpackhi_epi16(r16, one), rWeights)), gray_shift);
+			__m256i packed = _mm256_packs_epi32(low, high);
+			__m128i result = _mm_packus_epi16(_mm256_castsi256_si128(packed), _mm256_extracti128_si256(packed, 1));
+			_mm_storeu_si128((__m128i*)(gray + x), result);
+		}
+		GrayRowScalar(bgr, gray + x, width - x);
+	}
+
+	// Lines go up to 255 * 256 and don't fit a signed multiply-add, so they are biased
+	// by -32768 first. The weights sum to 256, which makes the bias exactly -2^23.
+	constexpr int blend_bias = (1 << 23) + (1 << 15);
+
+	__attribute__((target("sse2")))
+	void BlendRowSse(const uint16_t* line0, const uint16_t* line1, int weight1, uint8_t* dst, int width) {
+		const __m128i sign = _mm_set1_epi16((short)0x8000);
+		const __m128i weights = _mm_set1_epi32((weight_one - weight1) | (weight1 << 16));
+		const __m128i bias = _mm_set1_epi32(blend_bias);
+		int x = 0;
+		for (; x + 16 <= width; x += 16) {
+			__m128i results[2];
+			for (int half = 0; half < 2; half++) {
+				__m128i l0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(line0 + x + half * 8)), sign);
+				__m128i l1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(line1 + x + half * 8)), sign);
+				__m128i low = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(l0, l1), weights), bias), 16);
+				__m128i high = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(l0, l1), weights), bias), 16);
+				results[half] = _mm_packs_epi32(low, high);
+			}
+			_mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(results[0], results[1]));
+		}
+		BlendRowScalar(line0 + x, line1 + x, weight1, dst + x, width - x);
+	}
+
+	__attribute__((target("avx2")))
+	void BlendRowAvx2(const uint16_t* line0, const uint16_t* line1, int weight1, uint8_t* dst, int width) {
+		const __m256i sign = _mm256_set1_epi16((short)0x8000);
+		const __m256i weights = _mm256_set1_epi32((weight_one - weight1) | (weight1 << 16));
+		const __m256i bias = _mm256_set1_epi32(blend_bias);
+		int x = 0;
+		for (; x + 16 <= width; x += 16) {
+			__m256i l0 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(line0 + x)), sign);
+			__m256i l1 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(line1 + x)), sign);
+			__m256i low = _mm256_srli_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(l0, l1), weights), bias), 16);
+			__m256i high = _mm256_srli_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(l0, l1), weights), bias), 16);
+			__m256i packed = _mm256_packs_epi32(low, high);
+			__m128i result = _mm_packus_epi16(_mm256_castsi256_si128(packed), _mm256_extracti128_si256(packed, 1));
+			_mm_storeu_si128((__m128i*)(dst + x), result);
+		}
+		BlendRowScalar(line0 + x, line1 + x, weight1, dst + x, width - x);
+	}
+
+#endif
+
+#ifdef __ARM_NEON
+
+	// the rounding narrowing shifts are exactly the + half >> shift of the scalar code
+	void GrayRowNeon(const uint8_t* bgr, uint8_t* gray, int width) {
+		int x = 0;
+		for (; x + 16 <= width; x += 16, bgr += 48) {
+			uint8x16x3_t pixels = vld3q_u8(bgr);
+			uint16x8_t b[2] = { vmovl_u8(vget_low_u8(pixels.val[0])), vmovl_u8(vget_high_u8(pixels.val[0])) };
+			uint16x8_t g[2] = { vmovl_u8(vget_low_u8(pixels.val[1])), vmovl_u8(vget_high_u8(pixels.val[1])) };
+			uint16x8_t r[2] = { vmovl_u8(vget_low_u8(pixels.val[2])), vmovl_u8(vget_high_u8(pixels.val[2])) };
+			uint8x8_t results[2];
+			for (int half = 0; half < 2; half++) {
+				uint32x4_t low = vmull_n_u16(vget_low_u16(b[half]), gray_b);
+				low = vmlal_n_u16(low, vget_low_u16(g[half]), gray_g);
+				low = vmlal_n_u16(low, vget_low_u16(r[half]), gray_r);
+				uint32x4_t high = vmull_n_u16(vget_high_u16(b[half]), gray_b);
+				high = vmlal_n_u16(high, vget_high_u16(g[half]), gray_g);
+				high = vmlal_n_u16(high, vget_high_u16(r[half]), gray_r);
+				results[half] = vmovn_u16(vcombine_u16(vrshrn_n_u32(low, gray_shift), vrshrn_n_u32(high, gray_shift)));
+			}
+			vst1q_u8(gray + x, vcombine_u8(results[0], results[1]));
+		}
+		GrayRowScalar(bgr, gray + x, width - x);
+	}
+
+	void BlendRowNeon(const uint16_t* line0, const uint16_t* line1, int weight1, uint8_t* dst, int width) {
+		uint16_t weight0 = (uint16_t)(weight_one - weight1);
+		int x = 0;
+		for (; x + 8 <= width; x += 8) {
+			uint16x8_t l0 = vld1q_u16(line0 + x);
+			uint16x8_t l1 = vld1q_u16(line1 + x);
+			uint32x4_t low = vmlal_n_u16(vmull_n_u16(vget_low_u16(l0), weight0), vget_low_u16(l1), (uint16_t)weight1);
+			uint32x4_t high = vmlal_n_u16(vmull_n_u16(vget_high_u16(l0), weight0), vget_high_u16(l1), (uint16_t)weight1);
+			vst1_u8(dst + x, vmovn_u16(vcombine_u16(vrshrn_n_u32(low, 16), vrshrn_n_u32(high, 16))));
+		}
+		BlendRowScalar(line0 + x, line1 + x, weight1, dst + x, width - x);
+	}
+
+#endif
+
+	GrayRowFunction GrayRow(SimdLevel level) {
+		switch (level) {
+#ifdef ANT_X86
+		case SimdLevel::Sse: return GrayRowSse;
+		case SimdLevel::Avx2: return GrayRowAvx2;
+#endif
+#ifdef __ARM_NEON
+		case SimdLevel::Neon: return GrayRowNeon;
+#endif
+		default: return GrayRowScalar;
+		}
+	}
+
+	BlendRowFunction BlendRow(SimdLevel level) {
+		switch (level) {
+#ifdef ANT_X86
+		case SimdLevel::Sse: return BlendRowSse;
+		case SimdLevel::Avx2: return BlendRowAvx2;
+#endif
+#ifdef __ARM_NEON
+		case SimdLevel::Neon: return BlendRowNeon;
+#endif
+		default: return BlendRowScalar;
+		}
+	}
+
+	// horizontal pass on a gray row, the gathers don't vectorize well enough to be worth it
+	void ResampleRow(const uint8_t* gray, const std::vector<int>& offsets, const std::vector<uint16_t>& weights,
+		int begin, int end, uint16_t* line, int width) {
+
+		uint16_t first = (uint16_t)(gray[0] << 8);
+		int x = 0;
+		for (; x < begin; x++) {
+			line[x] = first;
+		}
+		for (; x < end; x++) {
+			const uint8_t* source = gray + offsets[x];
+			line[x] = (uint16_t)(source[0] * (weight_one - weights[x]) + source[1] * weights[x]);
+		}
+		if (x < width) {
+			uint16_t last = (uint16_t)(gray[offsets[width - 1]] << 8);
+			for (; x < width; x++) {
+				line[x] = last;
+			}
+		}
+	}
+}
+
+SimdLevel DetectSimd() {
+#ifdef __ARM_NEON
+	return SimdLevel::Neon;
+#elif defined(ANT_X86)
+	static SimdLevel level = __builtin_cpu_supports("avx2") ? SimdLevel::Avx2 :
+		__builtin_cpu_supports("ssse3") ? SimdLevel::Sse : SimdLevel::Scalar;
+	return level;
+#else
+	return SimdLevel::Scalar;
+#endif
+}
+
+const char* SimdName(SimdLevel level) {
+	switch (level) {
+	case SimdLevel::Sse: return "sse";
+	case SimdLevel::Avx2: return "avx2";
+	case SimdLevel::Neon: return "neon";
+	default: return "scalar";
+	}
+}
+
+std::vector<SimdLevel> AvailableSimd() {
+	std::vector<SimdLevel> levels { SimdLevel::Scalar };
+#ifdef ANT_X86
+	if (__builtin_cpu_supports("ssse3")) {
+		levels.push_back(SimdLevel::Sse);
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		levels.push_back(SimdLevel::Avx2);
+	}
+#endif
+#ifdef __ARM_NEON
+	levels.push_back(SimdLevel::Neon);
+#endif
+	return levels;
+}
+
+// Mirrors interpolationLinear::getCoeffs of OpenCV's bit-exact resize. OpenCV does
+// this in software double precision, the build keeps the compiler from fusing the
+// multiply and subtract so the hardware doubles round the same way.
+void GrayPreprocessor::Axis::Setup(int newSourceSize, int newSize) {
+	if (newSourceSize == sourceSize && newSize == size) {
+		return;
+	}
+	sourceSize = newSourceSize;
+	size = newSize;
+	offsets.assign(size, sourceSize - 1);
+	weights.assign(size, 0);
+	begin = 0;
+	end = size;
+
+	double scale = 1.0 / ((double)size / sourceSize);
+	for (int i = 0; i < size; i++) {
+		double position = scale * (i + 0.5) - 0.5;
+		int offset = (int)std::floor(position);
+		if (offset < 0 || sourceSize <= 1) {
+			begin = std::max(begin, i + 1);
+		}
+		else if (offset < sourceSize - 1) {
+			offsets[i] = offset;
+			weights[i] = (uint16_t)std::nearbyint((position - offset) * weight_one);
+		}
+		else {
+			end = std::min(end, i);
+		}
+	}
+}
+
+const uint16_t* GrayPreprocessor::Line(const cv::Mat& frame, int row, int keep, SimdLevel level) {
+	for (int i = 0; i < 2; i++) {
+		if (lineRows[i] == row) {
+			return lines[i].data();
+		}
+	}
+	int slot = lineRows[0] == keep ? 1 : 0;
+	const uint8_t* gray = frame.ptr<uint8_t>(row);
+	if (frame.channels() == 3) {
+		GrayRow(level)(gray, grayRow.data(), frame.cols);
+		gray = grayRow.data();
+	}
+	ResampleRow(gray, xAxis.offsets, xAxis.weights, xAxis.begin, xAxis.end, lines[slot].data(), xAxis.size);
+	lineRows[slot] = row;
+	return lines[slot].data();
+}
+
+void GrayPreprocessor::Downscale(const cv::Mat& frame, cv::Mat& dst, SimdLevel level) {
+	CV_Assert(frame.depth() == CV_8U && (frame.channels() == 1 || frame.channels() == 3) && dst.type() == CV_8UC1);
+
+	xAxis.Setup(frame.cols, dst.cols);
+	yAxis.Setup(frame.rows, dst.rows);
+	grayRow.resize(frame.cols);
+	for (int i = 0; i < 2; i++) {
+		lines[i].resize(dst.cols);
+		lineRows[i] = -1;
+	}
+	std::fill(std::begin(histogram), std::end(histogram), 0);
+
+	BlendRowFunction blend = BlendRow(level);
+	for (int y = 0; y < dst.rows; y++) {
+		uint8_t* row = dst.ptr<uint8_t>(y);
+		if (y < yAxis.begin || y >= yAxis.end) {
+			const uint16_t* line = Line(frame, y < yAxis.begin ? 0 : frame.rows - 1, -1, level);
+			for (int x = 0; x < dst.cols; x++) {
+				row[x] = (uint8_t)((line[x] + 128) >> 8);
+			}
+		}
+		else {
+			int offset = yAxis.offsets[y];
+			const uint16_t* line0 = Line(frame, offset, -1, level);
+			const uint16_t* line1 = Line(frame, offset + 1, offset, level);
+			blend(line0, line1, yAxis.weights[y], row, dst.cols);
+		}
+		// the row is still in L1
+		for (int x = 0; x < dst.cols; x++) {
+			histogram[row[x]]++;
+		}
+	}
+}
+
+// equalizeHist's table, including its single precision float scale
+void GrayPreprocessor::Equalize(cv::Mat& dst) {
+	uint32_t total = (uint32_t)dst.total();
+	if (!total) {
+		return;
+	}
+	int i = 0;
+	while (!histogram[i]) {
+		i++;
+	}
+	if (histogram[i] == total) {
+		dst.setTo(i);
+		return;
+	}
+
+	uint8_t lut[256] = {};
+	float scale = 255.0f / (float)(total - histogram[i]);
+	int sum = 0;
+	for (lut[i++] = 0; i < 256; i++) {
+		sum += histogram[i];
+		lut[i] = (uint8_t)std::clamp((int)std::lrint((float)sum * scale), 0, 255);
+	}
+
+	for (int y = 0; y < dst.rows; y++) {
+		uint8_t* row = dst.ptr<uint8_t>(y);
+		for (int x = 0; x < dst.cols; x++) {
+			row[x] = lut[row[x]];
+		}
+	}
+}
+
+void GrayPreprocessor::Run(const cv::Mat& frame, cv::Mat& dst, SimdLevel level) {
+	Downscale(frame, dst, level);
+	Equalize(dst);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "opencv2/core.hpp"
+#include <cstdint>
+#include <vector>
+
+// Instruction sets the fused preprocessing kernel has code paths for.
+enum class SimdLevel {
+	Scalar,
+	Sse, // SSSE3
+	Avx2,
+	Neon,
+};
+
+// best level this CPU supports, NEON is decided at compile time (always there on aarch64)
+SimdLevel DetectSimd();
+
+const char* SimdName(SimdLevel level);
+
+// every level this CPU can run, Scalar first
+std::vector<SimdLevel> AvailableSimd();
+
+// Fused replacement for cvtColor(BGR2GRAY), resize(INTER_LINEAR_EXACT) and equalizeHist.
+// Only the source rows the bilinear filter needs are converted to gray, each exactly
+// once, and the histogram is counted while the downscaled rows are written, so the
+// frame is streamed through the cache once and the result only a second time for the
+// equalization lookup. The output is bit-identical to the OpenCV sequence: fixed point
+// BT.601 gray with 14 bit coefficients, 8.8 fixed point bilinear weights as in OpenCV's
+// bit-exact resize and its float equalization table.
+class GrayPreprocessor {
+public:
+
+	// frame is BGR or gray, dst has to be CV_8UC1 of the downscaled size already
+	void Run(const cv::Mat& frame, cv::Mat& dst, SimdLevel level = DetectSimd());
+
+	// same split as Run, for timing the two passes separately
+	void Downscale(const cv::Mat& frame, cv::Mat& dst, SimdLevel level = DetectSimd());
+	void Equalize(cv::Mat& dst);
+
+private:
+
+	// source offsets and weights of one axis, outputs before begin take the first
+	// source pixel, from end on the last one
+	struct Axis {
+		std::vector<int> offsets;
+		std::vector<uint16_t> weights; // of offset + 1, offset gets 256 - weight
+		int begin = 0, end = 0;
+		int sourceSize = 0, size = 0;
+
+		void Setup(int newSourceSize, int newSize);
+	};
+
+	const uint16_t* Line(const cv::Mat& frame, int row, int keep, SimdLevel level);
+
+	Axis xAxis, yAxis;
+	std::vector<uint8_t> grayRow;
+	std::vector<uint16_t> lines[2];
+	int lineRows[2] = { -1, -1 };
+	uint32_t histogram[256];
+};
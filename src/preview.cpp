@@ -0,0 +1,93 @@
+#include "preview.hpp"
+#include "opencv2/highgui.hpp"
+#include "opencv2/imgproc.hpp"
+#include <algorithm>
+#include <iostream>
+
+constexpr const char* window_name = "Camera View";
+
+PreviewSink::PreviewSink(FramePool& pool, PreviewSettings settings) : pool(pool), settings(settings) {
+	if (settings.window) {
+		cv::namedWindow(window_name);
+	}
+}
+
+bool PreviewSink::Submit(cv::Mat& image, const std::vector<cv::Rect>& faces, double scale, Target target, Clock::time_point captureTime) {
+	if (!Enabled() || captureTime - lastSubmit < std::chrono::duration<double>(1.0 / settings.fps)) {
+		return false;
+	}
+	PreviewFrame frame { image, {}, std::min(faces.size(), PreviewFrame::max_faces), target };
+	for (size_t i = 0; i < frame.faceCount; i++) {
+		const cv::Rect& face = faces[i];
+		frame.faces[i] = { cvRound(face.x * scale), cvRound(face.y * scale), cvRound(face.width * scale), cvRound(face.height * scale) };
+	}
+	if (!frames.Push(std::move(frame))) {
+		return false;
+	}
+	image.release();
+	lastSubmit = captureTime;
+	return true;
+}
+
+bool PreviewSink::Update() {
+	PreviewFrame frame;
+	if (frames.PopLatest(frame, [this](PreviewFrame& skipped) { pool.Release(skipped.image); }) >= 0) {
+		Output(frame);
+	}
+	if (settings.window) {
+		cv::waitKey(1);
+		return cv::getWindowProperty(window_name, cv::WindowPropertyFlags::WND_PROP_VISIBLE) > 0;
+	}
+	return true;
+}
+
+void PreviewSink::Run() {
+	PreviewFrame frame;
+	int stale;
+	while (frames.WaitPopLatest(frame, stale, [this](PreviewFrame& skipped) { pool.Release(skipped.image); })) {
+		Output(frame);
+	}
+}
+
+void PreviewSink::Close() {
+	frames.Close();
+	if (settings.window && cv::getWindowProperty(window_name, cv::WindowPropertyFlags::WND_PROP_VISIBLE) > 0) {
+		cv::destroyWindow(window_name);
+	}
+}
+
+void PreviewSink::Output(PreviewFrame& frame) {
+
+	static const cv::Scalar drawColor1 = cv::Scalar(255, 0, 0);
+	static const cv::Scalar drawColor2 = cv::Scalar(0, 0, 255);
+
+	// luma frames are annotated in color, which also hands a capture buffer back early
+	if (frame.image.channels() == 1) {
+		cv::Mat color = pool.Acquire(frame.image.size(), CV_8UC3);
+		cv::cvtColor(frame.image, color, cv::COLOR_GRAY2BGR);
+		pool.Release(frame.image);
+		frame.image = std::move(color);
+	}
+
+	for (size_t i = 0; i < frame.faceCount; i++) {
+		cv::rectangle(frame.image, frame.faces[i], drawColor1, 3, 8, 0);
+	}
+	if (frame.target.x != INT32_MAX && frame.target.y != INT32_MAX) {
+		cv::Point frameCenter = { frame.image.cols / 2, frame.image.rows / 2 };
+		cv::circle(frame.image, { frameCenter.x - frame.target.x, frameCenter.y + frame.target.y }, 2, drawColor2, 3, 8, 0);
+	}
+
+	if (settings.window) {
+		cv::imshow(window_name, frame.image);
+	}
+	if (settings.file.size() && !writerFailed) {
+		if (!writer.isOpened() && !writer.open(settings.file, cv::VideoWriter::fourcc('M', 'J', 'P', 'G'), settings.fps, frame.image.size())) {
+			std::cout << "failed to open preview file " << settings.file << "!" << std::endl;
+			writerFailed = true;
+		}
+		else {
+			writer.write(frame.image);
+		}
+	}
+	pool.Release(frame.image);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "opencv2/core.hpp"
+#include "opencv2/videoio.hpp"
+#include "pipeline.hpp"
+#include "target.hpp"
+#include "frame_pool.hpp"
+#include <array>
+#include <string>
+#include <vector>
+
+struct PreviewSettings {
+	bool window = true; // show frames in a HighGUI window, must be serviced from the main thread
+	std::string file; // MJPEG .avi to record annotated frames to, empty to disable
+	double fps = 15.0; // frames per second accepted by the sink
+};
+
+// Annotated frame as handed from the detection stage to the preview sink.
+struct PreviewFrame {
+	static constexpr size_t max_faces = 8;
+	cv::Mat image;
+	std::array<cv::Rect, max_faces> faces; // in frame coordinates
+	size_t faceCount;
+	Target target;
+};
+
+// Asynchronous, rate-limited preview output. Detection only ever hands frames over
+// with a non-blocking Submit; drawing, display and encoding happen on whichever
+// thread services the sink, so none of it sits in the detection hot path.
+class PreviewSink {
+public:
+
+	PreviewSink(FramePool& pool, PreviewSettings settings);
+
+	bool Enabled() const {
+		return settings.window || settings.file.size();
+	}
+
+	// hands image over to the sink and returns true, or leaves it with the caller when
+	// the frame is rate limited or the sink is still busy with earlier ones
+	bool Submit(cv::Mat& image, const std::vector<cv::Rect>& faces, double scale, Target target, Clock::time_point captureTime);
+
+	// outputs the newest submitted frame if there is one
+	// returns false once the preview window was closed
+	bool Update();
+
+	// services the sink until Close, for running it on its own thread when there is no window
+	void Run();
+
+	void Close();
+
+	size_t Pending() const {
+		return frames.Size();
+	}
+
+private:
+
+	void Output(PreviewFrame& frame);
+
+	FramePool& pool;
+	PreviewSettings settings;
+	SpscQueue<PreviewFrame, 2> frames;
+	Clock::time_point lastSubmit;
+	cv::VideoWriter writer;
+	bool writerFailed = false;
+};
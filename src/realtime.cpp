@@ -0,0 +1,42 @@
+#include "realtime.hpp"
+#include <iostream>
+
+static unsigned long long CpuMask(const std::vector<int>& cpus) {
+	unsigned long long mask = 0;
+	for (int cpu : cpus) {
+		if (cpu >= 0 && cpu < 64) {
+			mask |= 1ull << cpu;
+		}
+	}
+	return mask;
+}
+
+void ConfigureRealtime(const RealtimeSettings& settings) {
+	unsigned long long rtMask = CpuMask(settings.cpus);
+	piRtConfigure(WPI_RT_SOFTPWM, settings.policy, settings.softPwmPriority, rtMask);
+	piRtConfigure(WPI_RT_SOFTTONE, settings.policy, settings.softTonePriority, rtMask);
+	piRtConfigure(WPI_RT_SOFTSERVO, settings.policy, settings.softServoPriority, rtMask);
+	piRtConfigure(WPI_RT_ISR, settings.policy, settings.isrPriority, rtMask);
+	piRtConfigure(actuation_subsystem, settings.policy, settings.actuationPriority, rtMask);
+
+	unsigned long long visionMask = 0;
+	cpu_set_t allowed;
+	if (rtMask && !sched_getaffinity(0, sizeof(allowed), &allowed)) {
+		for (int cpu = 0; cpu < 64; cpu++) {
+			if (CPU_ISSET(cpu, &allowed) && !(rtMask & (1ull << cpu))) {
+				visionMask |= 1ull << cpu;
+			}
+		}
+		if (!visionMask) {
+			std::cout << "no cores left for vision after reserving the real-time ones!" << std::endl;
+		}
+	}
+	piRtConfigure(vision_subsystem, SCHED_OTHER, 0, visionMask);
+
+	if (settings.lockMemory && piRtLockMemory(settings.stackPrefault)) {
+		std::cout << "failed to lock memory, real-time threads may stall on page faults!" << std::endl;
+	}
+	if (piRtApply(vision_subsystem)) {
+		std::cout << "failed to move the main thread off the real-time cores!" << std::endl;
+	}
+}
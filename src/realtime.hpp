@@ -0,0 +1,28 @@
+#pragma once
+
+#include "wiringPi.h"
+#include <sched.h>
+#include <vector>
+
+// wiringPi real-time subsystems used for this program's own threads
+constexpr int actuation_subsystem = WPI_RT_USER;
+constexpr int vision_subsystem = WPI_RT_USER + 1;
+
+struct RealtimeSettings {
+	int policy = SCHED_FIFO; // or SCHED_RR, for every real-time thread
+	std::vector<int> cpus; // cores kept for the real-time threads (e.g. isolcpus), empty for no pinning
+	bool lockMemory = false; // mlockall, pins every thread's whole stack and the OpenCV workers too, needs root or a large RLIMIT_MEMLOCK
+	unsigned int stackPrefault = 256 * 1024; // bytes of stack touched by each real-time thread
+	int softPwmPriority = 90;
+	int isrPriority = 55;
+	int actuationPriority = 50;
+	int softTonePriority = 50;
+	int softServoPriority = 50;
+};
+
+// Configures every wiringPi subsystem from settings and locks memory if asked to. The real-time
+// threads are pinned to settings.cpus and everything else, capture, detection,
+// preview and the threads OpenCV starts, to the remaining cores. Has to be called
+// from the main thread before any other thread is started, the vision placement is
+// applied to it and inherited by the threads it creates.
+void ConfigureRealtime(const RealtimeSettings& settings);
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "opencv2/core.hpp"
+#include "pipeline.hpp"
+#include "tracker.hpp"
+#include "detection.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+
+struct ResolutionSettings {
+	std::chrono::milliseconds latencyBudget { 20 }; // FindTarget time to stay under
+	double minScale = 1.0; // finest resolution, used while searching if the budget allows
+	double maxScale = 4.0; // coarsest resolution
+	double step = 1.25; // ratio between neighbouring scale levels
+	int faceSize = 48; // downscaled face height the locked target is kept at
+	cv::Size minSize { 30, 30 }; // smallest face a full scan looks for while searching
+};
+
+// Picks the downscale factor and minimum face size for the next frame. While a target
+// is locked the frame is shrunk until the face is about faceSize pixels high, so a
+// close target costs a fraction of the pixels. When the target is small or lost the
+// resolution goes back up, but never finer than what has kept FindTarget within the
+// latency budget. Scales snap to powers of step so the tracker is not rescaled, and
+// its face patch dropped, on every frame.
+class ResolutionController {
+public:
+
+	explicit ResolutionController(ResolutionSettings settings = {}) : settings(settings), budgetScale(settings.minScale) {
+		current.scale = settings.minScale;
+		current.minSize = settings.minSize;
+		lastScale = settings.minScale;
+	}
+
+	const DetectResolution& Next() const {
+		return current;
+	}
+
+	// feeds back the cost of the frame detected at Next() and the tracker state after it
+	void Update(Clock::duration latency, const TargetTracker& tracker) {
+		if (latency > settings.latencyBudget) {
+			budgetScale *= settings.step;
+		}
+		else if (latency < settings.latencyBudget / 2) {
+			budgetScale /= settings.step;
+		}
+		budgetScale = std::clamp(budgetScale, settings.minScale, settings.maxScale);
+
+		double scale = budgetScale;
+		cv::Size minSize = settings.minSize;
+		if (tracker.Locked()) {
+			cv::Rect face = tracker.LockedFace();
+			double faceScale = face.height * current.scale / settings.faceSize;
+			scale = std::clamp(faceScale, budgetScale, settings.maxScale);
+			// other faces have to be at least half the target's size to be picked up by a full scan
+			int faceMin = cvRound(face.height * current.scale / Snap(scale) / 2);
+			minSize.width = minSize.height = std::max(settings.minSize.height, faceMin);
+		}
+		current.scale = Snap(scale);
+		current.minSize = minSize;
+		lastScale.store(current.scale, std::memory_order_relaxed);
+	}
+
+	std::atomic<double> lastScale { 1.0 };
+
+private:
+
+	// rounds down to the nearest level minScale * step^n
+	double Snap(double scale) const {
+		if (scale >= settings.maxScale) {
+			return settings.maxScale;
+		}
+		double levels = std::floor(std::log(scale / settings.minScale) / std::log(settings.step) + 1e-6);
+		return std::min(settings.minScale * std::pow(settings.step, std::max(levels, 0.0)), settings.maxScale);
+	}
+
+	ResolutionSettings settings;
+	double budgetScale;
+	DetectResolution current;
+};
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstdint>
+
+struct Target {
+	int x, y; // relative to frame center, INT32_MAX when nothing was found
+};
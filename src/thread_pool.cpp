@@ -0,0 +1,140 @@
+#include "thread_pool.hpp"
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <charconv>
+#include <iostream>
+
+WorkStealingPool::WorkStealingPool(size_t threadCount, const std::vector<int>& cpus) : ranges(new Range[threadCount]) {
+	threads.reserve(threadCount);
+	for (size_t i = 0; i < threadCount; i++) {
+		threads.emplace_back(&WorkStealingPool::WorkerLoop, this, i);
+		if (cpus.size()) {
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(cpus[i % cpus.size()], &set);
+			if (pthread_setaffinity_np(threads.back().native_handle(), sizeof(set), &set)) {
+				std::cout << "failed to pin detection worker " << i << " to cpu " << cpus[i % cpus.size()] << "!" << std::endl;
+			}
+		}
+	}
+}
+
+WorkStealingPool::~WorkStealingPool() {
+	{
+		std::lock_guard lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+}
+
+void WorkStealingPool::Run(size_t count, const std::function<void(size_t, size_t)>& work) {
+	if (!count) {
+		return;
+	}
+	std::unique_lock lock(mutex);
+	// a worker that woke up late for the previous Run may still be looking for tasks with its body
+	done.wait(lock, [this] { return !active; });
+	size_t workers = threads.size();
+	for (size_t i = 0; i < workers; i++) {
+		std::lock_guard rangeLock(ranges[i].mutex);
+		ranges[i].begin = count * i / workers;
+		ranges[i].end = count * (i + 1) / workers;
+	}
+	body = &work;
+	remaining.store(count, std::memory_order_release);
+	generation++;
+	wake.notify_all();
+	done.wait(lock, [this] { return !remaining.load(std::memory_order_acquire); });
+	body = nullptr;
+}
+
+void WorkStealingPool::WorkerLoop(size_t worker) {
+	uint64_t seen = 0;
+	for (;;) {
+		const std::function<void(size_t, size_t)>* work;
+		{
+			std::unique_lock lock(mutex);
+			wake.wait(lock, [&] { return stopping || generation != seen; });
+			if (stopping) {
+				return;
+			}
+			seen = generation;
+			work = body;
+			active++;
+		}
+		size_t task;
+		while (Next(worker, task)) {
+			(*work)(task, worker);
+			if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				std::lock_guard lock(mutex);
+				done.notify_one();
+			}
+		}
+		std::lock_guard lock(mutex);
+		if (!--active) {
+			done.notify_one();
+		}
+	}
+}
+
+bool WorkStealingPool::Next(size_t worker, size_t& task) {
+	{
+		Range& own = ranges[worker];
+		std::lock_guard lock(own.mutex);
+		if (own.begin < own.end) {
+			task = own.begin++;
+			return true;
+		}
+	}
+	size_t workers = threads.size();
+	for (size_t i = 1; i < workers; i++) {
+		Range& victim = ranges[(worker + i) % workers];
+		size_t begin, end;
+		{
+			std::lock_guard lock(victim.mutex);
+			if (victim.begin >= victim.end) {
+				continue;
+			}
+			begin = victim.begin + (victim.end - victim.begin) / 2;
+			end = victim.end;
+			victim.end = begin;
+		}
+		task = begin;
+		if (begin + 1 < end) {
+			Range& own = ranges[worker];
+			std::lock_guard lock(own.mutex);
+			own.begin = begin + 1;
+			own.end = end;
+		}
+		return true;
+	}
+	return false;
+}
+
+bool ParseCpuList(const std::string& list, std::vector<int>& cpus) {
+	std::vector<int> parsed;
+	const char* begin = list.data();
+	const char* end = begin + list.size();
+	while (true) {
+		int cpu;
+		auto [next, error] = std::from_chars(begin, end, cpu);
+		// CPU_SET is undefined outside [0, CPU_SETSIZE)
+		if (error != std::errc() || cpu < 0 || cpu >= CPU_SETSIZE) {
+			return false;
+		}
+		parsed.push_back(cpu);
+		if (next == end) {
+			break;
+		}
+		if (*next != ',') {
+			return false;
+		}
+		begin = next + 1;
+	}
+	cpus = std::move(parsed);
+	return true;
+}
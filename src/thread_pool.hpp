@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fork-join pool with work stealing over task index ranges. Run splits [0, count) into
+// one contiguous range per worker, a worker that runs dry steals half of the remaining
+// range of another one, so unevenly sized tasks still keep every core busy.
+class WorkStealingPool {
+public:
+
+	// cpus pins worker i to cpus[i % cpus.size()], empty leaves placement to the scheduler
+	explicit WorkStealingPool(size_t threads, const std::vector<int>& cpus = {});
+	~WorkStealingPool();
+
+	WorkStealingPool(const WorkStealingPool&) = delete;
+	WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+	size_t Size() const {
+		return threads.size();
+	}
+
+	// calls body(task, worker) for every task in [0, count) and returns once all are done
+	void Run(size_t count, const std::function<void(size_t, size_t)>& body);
+
+private:
+
+	struct alignas(64) Range {
+		std::mutex mutex;
+		size_t begin = 0, end = 0;
+	};
+
+	void WorkerLoop(size_t worker);
+	bool Next(size_t worker, size_t& task);
+
+	std::vector<std::thread> threads;
+	std::unique_ptr<Range[]> ranges;
+	const std::function<void(size_t, size_t)>* body = nullptr;
+	std::atomic<size_t> remaining { 0 };
+	std::mutex mutex;
+	std::condition_variable wake, done;
+	uint64_t generation = 0;
+	size_t active = 0;
+	bool stopping = false;
+};
+
+// parses a comma separated cpu list such as "1,2,3" for pinning pool workers,
+// returns false and leaves cpus untouched if list is not of that form
+bool ParseCpuList(const std::string& list, std::vector<int>& cpus);
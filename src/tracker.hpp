@@ -0,0 +1,164 @@
+#pragma once
+
+#include "opencv2/core.hpp"
+#include "opencv2/imgproc.hpp"
+#include "detector.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+struct TrackerSettings {
+	int fullScanInterval = 15; // frames between forced full-frame scans while locked
+	double roiPadding = 0.75; // search margin around the predicted face, in face sizes
+	double minMatchScore = 0.6; // normalized correlation needed to coast on template matching
+	int maxCoastFrames = 3; // consecutive template-only frames before the lock is dropped
+};
+
+// Region-of-interest tracking on top of a detection engine. Once a face is locked the
+// detector only runs on a padded window around its predicted position, with the size
+// range narrowed to the tracked face. When the detector misses inside the window the
+// last face patch is template matched to bridge the gap, and the tracker falls back
+// to a full-frame scan every fullScanInterval frames or as soon as the target is lost.
+class TargetTracker {
+public:
+
+	explicit TargetTracker(TrackerSettings settings = {}) : settings(settings) {}
+
+	// fills faces with detections in image coordinates, full scans look for faces of at least minSize
+	void Detect(ObjectDetector& detector, const cv::Mat& image, std::vector<cv::Rect>& faces, cv::Size minSize) {
+		faces.clear();
+		if (locked && framesSinceFullScan < settings.fullScanInterval) {
+			framesSinceFullScan++;
+			if (DetectInWindow(detector, image, faces, minSize)) {
+				return;
+			}
+			locked = false;
+		}
+		framesSinceFullScan = 0;
+		coastFrames = 0;
+		fullScans.fetch_add(1, std::memory_order_relaxed);
+		detector.Detect(image, faces, minSize, cv::Size());
+	}
+
+	// full scan limited to regions of the full-size frame while nothing is locked, each is
+	// grown to at least twice minSize in the image so the detector has room around a face
+	void DetectRegions(ObjectDetector& detector, const cv::Mat& image, std::vector<cv::Rect>& faces, cv::Size minSize,
+		const std::vector<cv::Rect>& regions) {
+
+		faces.clear();
+		framesSinceFullScan = 0;
+		coastFrames = 0;
+		regionScans.fetch_add(1, std::memory_order_relaxed);
+		cv::Rect imageRect(0, 0, image.cols, image.rows);
+		for (const cv::Rect& frameRegion : regions) {
+			cv::Rect region(cvFloor(frameRegion.x / scale), cvFloor(frameRegion.y / scale),
+				cvCeil(frameRegion.width / scale), cvCeil(frameRegion.height / scale));
+			int growX = std::max(2 * minSize.width - region.width, 0);
+			int growY = std::max(2 * minSize.height - region.height, 0);
+			region = cv::Rect(region.x - growX / 2, region.y - growY / 2, region.width + growX, region.height + growY) & imageRect;
+			if (region.width < minSize.width || region.height < minSize.height) {
+				continue;
+			}
+			detector.Detect(image(region), regionFaces, minSize, cv::Size());
+			for (cv::Rect& face : regionFaces) {
+				faces.push_back(face + region.tl());
+			}
+		}
+	}
+
+	// follows the face picked as the target, face must be one of the last detections
+	void Lock(const cv::Mat& image, cv::Rect face) {
+		if (locked) {
+			velocity = { face.x - lastFace.x, face.y - lastFace.y };
+		}
+		else {
+			velocity = {};
+		}
+		face &= cv::Rect(0, 0, image.cols, image.rows);
+		image(face).copyTo(faceTemplate);
+		lastFace = face;
+		locked = !face.empty();
+	}
+
+	void Unlock() {
+		locked = false;
+	}
+
+	bool Locked() const {
+		return locked;
+	}
+
+	// locked face in image coordinates
+	cv::Rect LockedFace() const {
+		return lastFace;
+	}
+
+	// keeps the lock across a change of the downscale factor, the face patch is
+	// dropped since template matching only works at the scale it was taken at
+	void SetScale(double newScale) {
+		if (newScale == scale) {
+			return;
+		}
+		double ratio = scale / newScale;
+		lastFace = { cvRound(lastFace.x * ratio), cvRound(lastFace.y * ratio), cvRound(lastFace.width * ratio), cvRound(lastFace.height * ratio) };
+		velocity = { cvRound(velocity.x * ratio), cvRound(velocity.y * ratio) };
+		faceTemplate.release();
+		scale = newScale;
+	}
+
+	std::atomic<uint64_t> fullScans { 0 };
+	std::atomic<uint64_t> windowScans { 0 };
+	std::atomic<uint64_t> regionScans { 0 };
+	std::atomic<uint64_t> templateMatches { 0 };
+
+private:
+
+	bool DetectInWindow(ObjectDetector& detector, const cv::Mat& image, std::vector<cv::Rect>& faces, cv::Size minSize) {
+		cv::Rect predicted = lastFace + cv::Point(velocity.x, velocity.y);
+		int padX = cvRound(lastFace.width * settings.roiPadding);
+		int padY = cvRound(lastFace.height * settings.roiPadding);
+		cv::Rect window(predicted.x - padX, predicted.y - padY, predicted.width + 2 * padX, predicted.height + 2 * padY);
+		window &= cv::Rect(0, 0, image.cols, image.rows);
+		if (window.width < lastFace.width || window.height < lastFace.height) {
+			return false;
+		}
+
+		windowScans.fetch_add(1, std::memory_order_relaxed);
+		cv::Size windowMinSize(std::max(minSize.width, lastFace.width * 3 / 4), std::max(minSize.height, lastFace.height * 3 / 4));
+		cv::Size windowMaxSize(lastFace.width * 3 / 2, lastFace.height * 3 / 2);
+		detector.Detect(image(window), faces, windowMinSize, windowMaxSize);
+		if (faces.size()) {
+			for (cv::Rect& face : faces) {
+				face = face + window.tl();
+			}
+			coastFrames = 0;
+			return true;
+		}
+
+		if (coastFrames >= settings.maxCoastFrames || faceTemplate.empty()) {
+			return false;
+		}
+		double score;
+		cv::Point location;
+		cv::matchTemplate(image(window), faceTemplate, matchResult, cv::TM_CCOEFF_NORMED);
+		cv::minMaxLoc(matchResult, nullptr, &score, nullptr, &location);
+		if (score < settings.minMatchScore) {
+			return false;
+		}
+		templateMatches.fetch_add(1, std::memory_order_relaxed);
+		coastFrames++;
+		faces.push_back(cv::Rect(window.tl() + location, faceTemplate.size()));
+		return true;
+	}
+
+	TrackerSettings settings;
+	bool locked = false;
+	double scale = 1.0;
+	int framesSinceFullScan = 0;
+	int coastFrames = 0;
+	cv::Rect lastFace;
+	cv::Point velocity;
+	cv::Mat faceTemplate, matchResult;
+	std::vector<cv::Rect> regionFaces;
+};
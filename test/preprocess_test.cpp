@@ -0,0 +1,70 @@
+#include "../src/preprocess.hpp"
+#include "opencv2/imgproc.hpp"
+#include <iostream>
+
+// Checks the fused kernel against cvtColor(BGR2GRAY), resize(INTER_LINEAR_EXACT) and
+// equalizeHist on synthetic frames, for every SIMD level this CPU runs. Odd sizes and a
+// strided gray ROI make the vector loops run their scalar tails and edge clamping.
+
+// noise over a diagonal gradient, so the histogram is not flat and neighbours differ
+static cv::Mat SyntheticFrame(cv::Size size, int type, uint64_t seed) {
+	cv::Mat frame(size, type);
+	cv::RNG rng(seed);
+	rng.fill(frame, cv::RNG::UNIFORM, 0, 64);
+	for (int y = 0; y < frame.rows; y++) {
+		uint8_t* row = frame.ptr<uint8_t>(y);
+		for (int x = 0; x < frame.cols * frame.channels(); x++) {
+			row[x] = cv::saturate_cast<uint8_t>(row[x] + (x / frame.channels() + 2 * y) * 192 / (frame.cols + 2 * frame.rows));
+		}
+	}
+	return frame;
+}
+
+int main() {
+	const cv::Size frame_sizes[] = { { 640, 480 }, { 641, 479 }, { 333, 251 }, { 37, 23 } };
+	const double scales[] = { 1.0, 1.25, 1.5, 2.0, 2.7, 4.0, 5.3 };
+
+	std::vector<SimdLevel> levels = AvailableSimd();
+	GrayPreprocessor preprocessor;
+	cv::Mat gray, expected, result;
+	size_t cases = 0, failures = 0;
+
+	for (const cv::Size& frameSize : frame_sizes) {
+		cv::Mat color = SyntheticFrame(frameSize, CV_8UC3, cases + 1);
+		cv::Mat luma = SyntheticFrame(frameSize + cv::Size(16, 0), CV_8UC1, cases + 2);
+		// camera luma planes can have a row stride wider than the image
+		cv::Mat strided = luma(cv::Rect(8, 0, frameSize.width, frameSize.height));
+		for (const cv::Mat* frame : { &color, &strided }) {
+			if (frame->channels() == 3) {
+				cv::cvtColor(*frame, gray, cv::COLOR_BGR2GRAY);
+			}
+			else {
+				gray = *frame;
+			}
+			for (double scale : scales) {
+				cv::Size size(std::max(cvRound(frameSize.width / scale), 1), std::max(cvRound(frameSize.height / scale), 1));
+				cv::resize(gray, expected, size, 0, 0, cv::INTER_LINEAR_EXACT);
+				cv::equalizeHist(expected, expected);
+				for (SimdLevel level : levels) {
+					result.create(size, CV_8UC1);
+					preprocessor.Run(*frame, result, level);
+					int differing = cv::countNonZero(result != expected);
+					cases++;
+					if (differing) {
+						failures++;
+						std::cout << SimdName(level) << " " << (frame->channels() == 3 ? "BGR " : "gray ") << frameSize.width << "x"
+							<< frameSize.height << " to " << size.width << "x" << size.height << ": " << differing
+							<< " pixels differ from OpenCV!" << std::endl;
+					}
+				}
+			}
+		}
+	}
+
+	std::cout << cases - failures << " of " << cases << " cases bit-exact";
+	for (SimdLevel level : levels) {
+		std::cout << " " << SimdName(level);
+	}
+	std::cout << std::endl;
+	return failures ? 1 : 0;
+}